@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "bank.h"
+#include "distributed.h"
+#include "stream.h"
+
+/**
+ * Bank of single process.
+ */
+struct Bank {
+    balance_t        balance;   ///< Current balance of account (only in child)
+    timestamp_t      recorded;  ///< Lamport time of the last recorded step (only in child)
+    long             total;     ///< Sum of initial balances of all accounts
+    BalanceHistory  *history;   ///< Own history preallocated for all steps (only in child)
+    BalanceHistory **histories; ///< Histories of children by identifier (only in parent)
+};
+
+/**
+ * Records current balance at current Lamport time. Steps since the previous
+ * record repeat previous balance.
+ *
+ * @param state a state of current child process
+ * @return 0 if success
+ */
+int record_balance(ProcessState *state);
+
+/**
+ * Adds money in transit to steps of history in range [from, to).
+ *
+ * @param state a state of current child process
+ * @param from Lamport time when money was sent
+ * @param to Lamport time when money was received
+ * @param amount amount of money
+ */
+void add_pending(ProcessState *state, timestamp_t from, timestamp_t to, balance_t amount);
+
+/**
+ * Applies transfer order: source account forwards it to destination,
+ * destination acknowledges it to parent.
+ *
+ * @param state a state of current child process
+ * @param message message with transfer order
+ * @return 0 if success
+ */
+int apply_transfer(ProcessState *state, const Message *message);
+
+/**
+ * Receives balance history of child as stream to buffer of its size.
+ *
+ * @param state a state of parent process
+ * @param from identifier of child
+ * @return 0 if success
+ */
+int receive_history(ProcessState *state, local_id from);
+
+/**
+ * Prints histories of all accounts merged in single pass over time and checks
+ * that total amount of money never changes. Lengths of histories must be
+ * already checked against their streams.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int print_history(ProcessState *state);
+
+int init_bank(ProcessState *state, const Options *options) {
+    struct Bank *bank;
+
+    state->bank = NULL;
+    if (!options->balances) {
+        return 0;
+    }
+
+    bank = calloc(1, sizeof(struct Bank));
+    if (!bank) {
+        return 1;
+    }
+    for (long id = 0; id < options->processes_count; ++id) {
+        bank->total += strtol(options->balances[id], NULL, 10);
+    }
+
+    if (state->id == PARENT_ID) {
+        bank->histories = calloc((size_t) options->processes_count + 1, sizeof(BalanceHistory *));
+    } else {
+        BalanceHistory *history;
+
+        history = malloc(offsetof(BalanceHistory, s_history) + MAX_HISTORY_LEN * sizeof(BalanceStep));
+        if (history) {
+            bank->balance = (balance_t) strtol(options->balances[state->id - 1], NULL, 10);
+            bank->recorded = 0;
+
+            history->s_id = state->id;
+            history->s_reserved = 0;
+            history->s_history_len = 1;
+            history->s_history[0].s_balance = bank->balance;
+            history->s_history[0].s_balance_pending_in = 0;
+        }
+        bank->history = history;
+    }
+    if (!bank->history && !bank->histories) {
+        free(bank);
+        return 1;
+    }
+
+    state->bank = bank;
+    return 0;
+}
+
+void release_bank(ProcessState *state) {
+    if (state->bank) {
+        if (state->bank->histories) {
+            for (long id = 1; id <= state->processes_count; ++id) {
+                free(state->bank->histories[id]);
+            }
+        }
+        free(state->bank->history);
+        free(state->bank->histories);
+        free(state->bank);
+        state->bank = NULL;
+    }
+}
+
+int transfer(ProcessState *state, local_id src, local_id dst, balance_t amount) {
+    Message message;
+    TransferOrder order;
+
+    order.s_src = src;
+    order.s_dst = dst;
+    order.s_amount = amount;
+
+    message.s_header.s_magic = MESSAGE_MAGIC;
+    message.s_header.s_type = TRANSFER;
+    message.s_header.s_payload_len = sizeof(TransferOrder);
+    message.s_header.s_local_time = 0;
+    memcpy(message.s_payload, &order, sizeof(TransferOrder));
+
+    if (send(state, src, &message)) {
+        fprintf(stderr, "Failed to send transfer order: src=%d dst=%d\n", src, dst);
+        return 1;
+    }
+    if (receive(state, dst, &message)) {
+        fprintf(stderr, "Failed to receive acknowledgement of transfer: src=%d dst=%d\n", src, dst);
+        return 2;
+    }
+    if (message.s_header.s_type != ACK) {
+        fprintf(stderr, "Message has incorrect type: from=%d type=%d\n", dst, message.s_header.s_type);
+        return 3;
+    }
+
+    return 0;
+}
+
+int bank_robbery(ProcessState *state, local_id max_id) {
+    for (int i = 1; i < max_id; ++i) {
+        if (transfer(state, (local_id) i, (local_id) (i + 1), (balance_t) i)) {
+            return 1;
+        }
+    }
+    if (max_id > 1 && transfer(state, max_id, 1, 1)) {
+        return 1;
+    }
+    return 0;
+}
+
+int serve_transfers(ProcessState *state) {
+    char pending[state->processes_count + 1];
+    Message message;
+
+    for (int id = 0; id <= state->processes_count; ++id) {
+        pending[id] = id != state->id;
+    }
+
+    for (;;) {
+        if (receive_any_of(state, pending, &message)) {
+            fprintf(stderr, "(%d) Failed to receive message from any process\n", state->id);
+            return 1;
+        }
+
+        switch (message.s_header.s_type) {
+            case TRANSFER:
+                if (apply_transfer(state, &message)) {
+                    return 2;
+                }
+                break;
+            case STOP:
+                return 0;
+            case DONE:
+                state->done_received[state->last_from] = 1;
+                break;
+            default:
+                fprintf(stderr, "(%d) Message has incorrect type: from=%d type=%d\n",
+                        state->id, state->last_from, message.s_header.s_type);
+                return 3;
+        }
+    }
+}
+
+int apply_transfer(ProcessState *state, const Message *message) {
+    struct Bank *bank;
+    TransferOrder order;
+    char buffer[MAX_PAYLOAD_LEN];
+
+    bank = state->bank;
+    memcpy(&order, message->s_payload, sizeof(TransferOrder));
+
+    if (order.s_src == state->id) {
+        bank->balance = (balance_t) (bank->balance - order.s_amount);
+        if (send(state, order.s_dst, message)) {
+            fprintf(stderr, "(%d) Failed to forward transfer: to=%d\n", state->id, order.s_dst);
+            return 1;
+        }
+        if (record_balance(state)) {
+            return 2;
+        }
+        sprintf(buffer, log_transfer_out_fmt, state->local_time, state->id, order.s_amount, order.s_dst);
+    } else if (order.s_dst == state->id) {
+        Message ack;
+
+        bank->balance = (balance_t) (bank->balance + order.s_amount);
+        if (record_balance(state)) {
+            return 2;
+        }
+        add_pending(state, message->s_header.s_local_time, state->local_time, order.s_amount);
+        sprintf(buffer, log_transfer_in_fmt, state->local_time, state->id, order.s_amount, order.s_src);
+
+        ack.s_header.s_magic = MESSAGE_MAGIC;
+        ack.s_header.s_type = ACK;
+        ack.s_header.s_payload_len = 0;
+        ack.s_header.s_local_time = 0;
+        if (send(state, PARENT_ID, &ack)) {
+            fprintf(stderr, "(%d) Failed to acknowledge transfer\n", state->id);
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "(%d) Transfer doesn't belong to process: src=%d dst=%d\n",
+                state->id, order.s_src, order.s_dst);
+        return 3;
+    }
+
+    log_event(state, buffer);
+    return 0;
+}
+
+int send_history(ProcessState *state) {
+    BalanceHistory *history;
+
+    if (record_balance(state)) {
+        return 1;
+    }
+
+    history = state->bank->history;
+    if (send_stream(state, PARENT_ID, BALANCE_HISTORY, (const char *) history,
+                    offsetof(BalanceHistory, s_history) + history->s_history_len * sizeof(BalanceStep))) {
+        fprintf(stderr, "(%d) Failed to send balance history\n", state->id);
+        return 2;
+    }
+    return 0;
+}
+
+int receive_histories(ProcessState *state) {
+    for (int id = 1; id <= state->processes_count; ++id) {
+        if (receive_history(state, (local_id) id)) {
+            return 1;
+        }
+    }
+
+    return print_history(state);
+}
+
+int receive_history(ProcessState *state, local_id from) {
+    Stream stream;
+    BalanceHistory *history;
+    char *data;
+
+    if (accept_stream(state, &stream, from, BALANCE_HISTORY)) {
+        fprintf(stderr, "Failed to receive balance history: from=%d\n", from);
+        return 1;
+    }
+    if (stream.size < offsetof(BalanceHistory, s_history) + sizeof(BalanceStep)
+        || stream.size > offsetof(BalanceHistory, s_history) + MAX_HISTORY_LEN * sizeof(BalanceStep)) {
+        fprintf(stderr, "Balance history has incorrect size: from=%d size=%zu\n", from, stream.size);
+        return 2;
+    }
+    if (!(data = malloc(stream.size))) {
+        fprintf(stderr, "Failed to allocate balance history: from=%d size=%zu\n", from, stream.size);
+        return 3;
+    }
+    state->bank->histories[from] = (BalanceHistory *) data;
+
+    while (stream.offset < stream.size) {
+        if (receive_fragment(state, &stream, data)) {
+            fprintf(stderr, "Failed to receive balance history: from=%d\n", from);
+            return 4;
+        }
+    }
+
+    history = state->bank->histories[from];
+    if (!history->s_history_len
+        || offsetof(BalanceHistory, s_history) + history->s_history_len * sizeof(BalanceStep) != stream.size) {
+        fprintf(stderr, "Balance history has incorrect length: from=%d length=%d size=%zu\n",
+                from, history->s_history_len, stream.size);
+        return 5;
+    }
+    return 0;
+}
+
+int record_balance(ProcessState *state) {
+    struct Bank *bank;
+    BalanceHistory *history;
+    timestamp_t time;
+
+    bank = state->bank;
+    history = bank->history;
+    time = state->local_time;
+
+    if (time < bank->recorded || time >= MAX_HISTORY_LEN) {
+        fprintf(stderr, "(%d) Lamport time is out of balance history: time=%d limit=%d\n",
+                state->id, time, MAX_HISTORY_LEN);
+        return 1;
+    }
+
+    for (timestamp_t t = (timestamp_t) (bank->recorded + 1); t < time; ++t) {
+        history->s_history[t].s_balance = history->s_history[bank->recorded].s_balance;
+        history->s_history[t].s_balance_pending_in = 0;
+    }
+    history->s_history[time].s_balance = bank->balance;
+    history->s_history[time].s_balance_pending_in = 0;
+    history->s_history_len = (uint16_t) (time + 1);
+    bank->recorded = time;
+
+    return 0;
+}
+
+void add_pending(ProcessState *state, timestamp_t from, timestamp_t to, balance_t amount) {
+    BalanceHistory *history;
+
+    history = state->bank->history;
+    for (timestamp_t t = from < 0 ? 0 : from; t < to; ++t) {
+        history->s_history[t].s_balance_pending_in = (balance_t) (history->s_history[t].s_balance_pending_in + amount);
+    }
+}
+
+int print_history(ProcessState *state) {
+    struct Bank *bank;
+    long length, errors;
+
+    bank = state->bank;
+    length = 0;
+    for (int id = 1; id <= state->processes_count; ++id) {
+        BalanceHistory *history = bank->histories[id];
+
+        if (history->s_history_len > length) {
+            length = history->s_history_len;
+        }
+    }
+
+    printf("Full balance history for time range [0;%ld]\n", length - 1);
+    errors = 0;
+    for (long t = 0; t < length; ++t) {
+        long total;
+
+        total = 0;
+        printf("%5ld |", t);
+        for (int id = 1; id <= state->processes_count; ++id) {
+            BalanceHistory *history;
+            BalanceStep *step;
+
+            history = bank->histories[id];
+            step = &history->s_history[t < history->s_history_len ? t : history->s_history_len - 1];
+            total += step->s_balance + step->s_balance_pending_in;
+            printf(" %5d (%d)", step->s_balance, step->s_balance_pending_in);
+        }
+        printf(" | %ld\n", total);
+        errors += total != bank->total;
+    }
+    fflush(stdout);
+
+    if (errors) {
+        fprintf(stderr, "Total balance differs from initial one: steps=%ld total=%ld\n", errors, bank->total);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "core.h"
+
+#ifndef PA1_BANK_H
+#define PA1_BANK_H
+
+typedef int16_t balance_t;
+
+/**
+ * Balance of account at single moment of Lamport time. Time is not stored,
+ * it is the index of step in history.
+ */
+typedef struct {
+    balance_t s_balance;            ///< Balance of account
+    balance_t s_balance_pending_in; ///< Money sent to account but not received yet
+} __attribute__((packed)) BalanceStep;
+
+enum {
+    MAX_HISTORY_LEN = INT16_MAX + 1 ///< Count of steps for every value of Lamport time
+};
+
+/**
+ * History of balance indexed by Lamport time. It is sent as is as stream of
+ * BALANCE_HISTORY messages, so history of thousands of steps isn't limited
+ * by MAX_PAYLOAD_LEN and is sent right from memory of child.
+ */
+typedef struct {
+    local_id    s_id;          ///< Identifier of account owner
+    uint8_t     s_reserved;    ///< Unused
+    uint16_t    s_history_len; ///< Count of recorded steps
+    BalanceStep s_history[];   ///< Steps indexed by Lamport time
+} __attribute__((packed)) BalanceHistory;
+
+/**
+ * Order to transfer money sent by parent to source account.
+ */
+typedef struct {
+    local_id  s_src;    ///< Identifier of source account
+    local_id  s_dst;    ///< Identifier of destination account
+    balance_t s_amount; ///< Amount of money to transfer
+} __attribute__((packed)) TransferOrder;
+
+static const char * const log_transfer_out_fmt =
+    "%d: process %1d transferred $ %2d to process %1d\n";
+
+static const char * const log_transfer_in_fmt =
+    "%d: process %1d received $ %2d from process %1d\n";
+
+/**
+ * Allocates bank of current process: account with history for child and
+ * table of histories for parent.
+ *
+ * @param state a state of current process
+ * @param options options of run with initial balances of children
+ * @return 0 if success
+ */
+int init_bank(ProcessState *state, const Options *options);
+
+/**
+ * Releases bank of current process.
+ *
+ * @param state a state of current process
+ */
+void release_bank(ProcessState *state);
+
+/**
+ * Sends transfer order to source account and waits for acknowledgement of
+ * destination account.
+ *
+ * @param state a state of parent process
+ * @param src identifier of source account
+ * @param dst identifier of destination account
+ * @param amount amount of money to transfer
+ * @return 0 if success
+ */
+int transfer(ProcessState *state, local_id src, local_id dst, balance_t amount);
+
+/**
+ * Makes chain of transfers between all accounts.
+ *
+ * @param state a state of parent process
+ * @param max_id identifier of the last account
+ * @return 0 if success
+ */
+int bank_robbery(ProcessState *state, local_id max_id);
+
+/**
+ * Applies transfer orders until parent sends STOP. DONE of other children
+ * received in the meantime is remembered.
+ *
+ * @param state a state of current child process
+ * @return 0 if success
+ */
+int serve_transfers(ProcessState *state);
+
+/**
+ * Sends balance history of current child to parent as stream. History is
+ * recorded up to current Lamport time.
+ *
+ * @param state a state of current child process
+ * @return 0 if success
+ */
+int send_history(ProcessState *state);
+
+/**
+ * Receives balance histories of all children and prints them merged.
+ * History that is empty or whose length doesn't match size of its stream is
+ * rejected.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int receive_histories(ProcessState *state);
+
+#endif //PA1_BANK_H
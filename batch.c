@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include "batch.h"
+#include "pipes.h"
+#include "connections.h"
+#include "counters.h"
+#include "codec.h"
+#include "clock.h"
+
+int batch_frame(ProcessState *state, local_id to, const unsigned char *header,
+                const char *payload, size_t payload_len) {
+    OutputBatch *batch;
+    size_t frame_len;
+
+    batch = &state->batches[to];
+    frame_len = sizeof(MessageHeader) + payload_len;
+
+    if (batch->size + frame_len > state->batch_limit && flush_batch(state, to)) {
+        return 1;
+    }
+
+    if (frame_len >= state->batch_limit) {
+        struct iovec iov[2];
+
+        iov[0].iov_base = (void *) header;
+        iov[0].iov_len = sizeof(MessageHeader);
+        iov[1].iov_base = (void *) payload;
+        iov[1].iov_len = payload_len;
+        return write_pipe(state, to, iov, payload_len ? 2 : 1);
+    }
+
+    if (!batch->data && !(batch->data = malloc(state->batch_limit))) {
+        fprintf(stderr, "(%d) Failed to allocate batch: to=%d\n", state->id, to);
+        return 1;
+    }
+    if (!batch->size) {
+        batch->first_at = monotonic_ns();
+        ++state->dirty_batches;
+    }
+
+    memcpy(&batch->data[batch->size], header, sizeof(MessageHeader));
+    memcpy(&batch->data[batch->size + sizeof(MessageHeader)], payload, payload_len);
+    batch->size += frame_len;
+
+    if (batch->size == state->batch_limit || monotonic_ns() - batch->first_at >= state->batch_delay * 1000LL) {
+        return flush_batch(state, to);
+    }
+
+    return 0;
+}
+
+int batch_control(ProcessState *state, local_id to, const unsigned char *header) {
+    OutputBatch *batch;
+
+    batch = &state->batches[to];
+    if (!batch->data && !(batch->data = malloc(CONTROL_BATCH_LIMIT))) {
+        fprintf(stderr, "(%d) Failed to allocate control batch: to=%d\n", state->id, to);
+        return 1;
+    }
+    if (!batch->size) {
+        ++state->dirty_batches;
+    }
+
+    memcpy(&batch->data[batch->size], header, sizeof(MessageHeader));
+    batch->size += sizeof(MessageHeader);
+
+    if (batch->size + sizeof(MessageHeader) > CONTROL_BATCH_LIMIT) {
+        return flush_batch(state, to);
+    }
+
+    return 0;
+}
+
+int write_frame(ProcessState *state, local_id to, const unsigned char *header,
+                const char *payload, size_t payload_len) {
+    OutputBatch *batch;
+    struct iovec iov[3];
+    int count;
+
+    batch = &state->batches[to];
+    count = 0;
+    if (batch->size) {
+        iov[count].iov_base = batch->data;
+        iov[count++].iov_len = batch->size;
+        batch->size = 0;
+        --state->dirty_batches;
+    }
+    iov[count].iov_base = (void *) header;
+    iov[count++].iov_len = sizeof(MessageHeader);
+    if (payload_len) {
+        iov[count].iov_base = (void *) payload;
+        iov[count++].iov_len = payload_len;
+    }
+
+    return write_pipe(state, to, iov, count);
+}
+
+int flush_batch(ProcessState *state, local_id to) {
+    OutputBatch *batch;
+    struct iovec iov;
+
+    batch = &state->batches[to];
+    if (!batch->size) {
+        return 0;
+    }
+
+    iov.iov_base = batch->data;
+    iov.iov_len = batch->size;
+    batch->size = 0;
+    --state->dirty_batches;
+
+    return write_pipe(state, to, &iov, 1);
+}
+
+int flush_batches(ProcessState *state) {
+    int id;
+
+    for (id = 0; state->dirty_batches > 0 && id <= state->processes_count; ++id) {
+        if (flush_batch(state, id)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+const unsigned char *next_frame(const InputBuffer *input) {
+    return input->start < input->checked ? &input->data[input->start] : NULL;
+}
+
+int fill_input(ProcessState *state, local_id from) {
+    InputBuffer *input;
+    ssize_t bytes_read;
+    long long started;
+    size_t consumed;
+
+    if (flush_batches(state)) {
+        return 1;
+    }
+
+    if (state->transport == TRANSPORT_SOCKETS) {
+        struct pollfd fd;
+
+        if (connect_peer(state, from)) {
+            return 1;
+        }
+        fd.fd = state->reading_pipes[from];
+        fd.events = POLLIN;
+        do {
+            fd.revents = 0;
+            if (poll_connections(state, &fd, 1, -1) < 0) {
+                return 1;
+            }
+        } while (!fd.revents);
+    }
+
+    input = &state->inputs[from];
+    if (!input->data && !(input->data = malloc(INPUT_BUFFER_SIZE))) {
+        fprintf(stderr, "(%d) Failed to allocate input buffer: from=%d\n", state->id, from);
+        return 1;
+    }
+    if (input->start > 0) {
+        memmove(input->data, &input->data[input->start], input->end - input->start);
+        input->end -= input->start;
+        input->checked -= input->start;
+        input->start = 0;
+    }
+    if (input->end == INPUT_BUFFER_SIZE) {
+        fprintf(stderr, "(%d) Frame doesn't fit into input buffer: from=%d\n", state->id, from);
+        return 2;
+    }
+
+    started = counters_clock(state);
+    count_read(state);
+    while ((bytes_read = read(state->reading_pipes[from], &input->data[input->end],
+                              INPUT_BUFFER_SIZE - input->end)) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd fd;
+
+            fd.fd = state->reading_pipes[from];
+            fd.events = POLLIN;
+            count_poll(state);
+            if (poll(&fd, 1, -1) < 0 && errno != EINTR) {
+                fprintf(stderr, "(%d) Failed to poll pipe: descriptor=%d error=%s\n",
+                        state->id, fd.fd, strerror(errno));
+                return 3;
+            }
+        } else if (errno != EINTR) {
+            fprintf(stderr, "(%d) Failed to read from pipe: descriptor=%d error=%s\n",
+                    state->id, state->reading_pipes[from], strerror(errno));
+            return 3;
+        }
+        count_read(state);
+    }
+    count_blocked(state, started);
+    if (!bytes_read) {
+        fprintf(stderr, "(%d) Pipe was closed by process: from=%d descriptor=%d\n",
+                state->id, from, state->reading_pipes[from]);
+        return FILL_CLOSED;
+    }
+    input->end += bytes_read;
+
+    if (decode_headers(&input->data[input->checked], input->end - input->checked, NULL, LONG_MAX, &consumed) < 0) {
+        fprintf(stderr, "(%d) Invalid message header: from=%d offset=%zu\n", state->id, from, input->checked + consumed);
+        return 5;
+    }
+    input->checked += consumed;
+
+    return 0;
+}
+
+void release_buffers(ProcessState *state) {
+    int id;
+
+    for (id = 0; id <= state->processes_count; ++id) {
+        free(state->batches[id].data);
+        state->batches[id].data = NULL;
+        state->batches[id].size = 0;
+
+        free(state->inputs[id].data);
+        state->inputs[id].data = NULL;
+        state->inputs[id].start = state->inputs[id].checked = state->inputs[id].end = 0;
+    }
+    state->dirty_batches = 0;
+}
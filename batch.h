@@ -0,0 +1,103 @@
+#include "core.h"
+
+#ifndef PA1_BATCH_H
+#define PA1_BATCH_H
+
+enum {
+    INPUT_BUFFER_SIZE = 4 * MAX_MESSAGE_LEN, ///< Size of buffer for incoming bytes from single source
+    BATCH_DEFAULT_DELAY = 1000,              ///< Default age of batch to flush in microseconds
+    CONTROL_BATCH_LIMIT = 512,               ///< Size of batch of header-only frames coalesced without batching
+    FILL_CLOSED = 4                          ///< Result of fill_input() if channel was closed by peer
+};
+
+/**
+ * Appends frame to the batch of destination. Batch is flushed when it reaches
+ * size or age limit. Frames that do not fit into batch are written directly.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param header serialized message header
+ * @param payload message payload
+ * @param payload_len length of payload
+ * @return 0 if success
+ */
+int batch_frame(ProcessState *state, local_id to, const unsigned char *header,
+                const char *payload, size_t payload_len);
+
+/**
+ * Appends header-only frame to the batch of destination when batching is
+ * disabled and coalescing is enabled. Control frames are written together
+ * with the next frame to the same destination or before current process
+ * blocks, so several of them take a single write. Until then they are
+ * delayed, so coalescing is opt-in.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param header serialized message header
+ * @return 0 if success
+ */
+int batch_control(ProcessState *state, local_id to, const unsigned char *header);
+
+/**
+ * Writes frame to destination with single write, prepending control frames
+ * buffered for it by batch_control().
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param header serialized message header
+ * @param payload message payload
+ * @param payload_len length of payload
+ * @return 0 if success
+ */
+int write_frame(ProcessState *state, local_id to, const unsigned char *header,
+                const char *payload, size_t payload_len);
+
+/**
+ * Writes buffered frames of destination with single write.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @return 0 if success
+ */
+int flush_batch(ProcessState *state, local_id to);
+
+/**
+ * Writes buffered frames of all destinations.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int flush_batches(ProcessState *state);
+
+/**
+ * Returns the first complete frame buffered from source. Header of returned
+ * frame was already validated by fill_input().
+ *
+ * @param input incoming bytes of source
+ * @return serialized frame or NULL if there is no complete frame
+ */
+const unsigned char *next_frame(const InputBuffer *input);
+
+/**
+ * Reads as many bytes as available from source into its input buffer, so
+ * single read() may supply many frames and a partial frame is kept for the
+ * next call. Blocks until at least one byte is read, waiting with poll()
+ * if pipe is in non-blocking mode. Flushes all batches before
+ * blocking, so peers never wait for frames buffered here. Headers of all
+ * completed frames are validated at once, so corrupted stream is reported
+ * right after it's read.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @return 0 if success, FILL_CLOSED if channel was closed by peer
+ */
+int fill_input(ProcessState *state, local_id from);
+
+/**
+ * Releases all batches and input buffers of current process.
+ *
+ * @param state a state of current process
+ */
+void release_buffers(ProcessState *state);
+
+#endif //PA1_BATCH_H
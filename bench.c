@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "distributed.h"
+#include "stream.h"
+#include "clock.h"
+
+static const char *const bench_names[] = {"none", "pingpong", "multicast", "barrier", "stream", "all"};
+static const char *const transport_names[] = {"pipes", "shm", "sockets", "queues"};
+static const char *const barrier_names[] = {"all", "dissemination"};
+
+/**
+ * Runs iterations of single workload. Parent measures latency of every
+ * iteration, children only serve parent and each other.
+ *
+ * @param state a state of current process
+ * @param kind workload to run, not BENCH_ALL
+ * @param message message to send with payload of measured size
+ * @param count count of iterations
+ * @param latencies latencies of iterations in nanoseconds, NULL for children
+ * @return 0 if success
+ */
+int bench_workload(ProcessState *state, BenchKind kind, Message *message, long count, long long *latencies);
+
+/**
+ * Passes barrier of chosen algorithm where every process sends message.
+ *
+ * @param state a state of current process
+ * @param message barrier message
+ * @param received buffer for received messages
+ * @return 0 if success
+ */
+int bench_barrier(ProcessState *state, const Message *message, Message *received);
+
+/**
+ * Sends buffer of BENCH_STREAM_LEN bytes from parent to the first child as
+ * stream and back. Parent checks that echoed buffer is the same.
+ *
+ * @param state a state of current process
+ * @param type type of messages of streams
+ * @param data buffer of 2 * BENCH_STREAM_LEN bytes, the first half is sent by parent
+ * @return 0 if success
+ */
+int bench_stream(ProcessState *state, int16_t type, char *data);
+
+/**
+ * Returns count of messages sent by all processes during single iteration.
+ *
+ * @param state a state of current process
+ * @param kind workload, not BENCH_ALL
+ * @return count of messages
+ */
+long bench_messages(ProcessState *state, BenchKind kind);
+
+/**
+ * Prints percentiles of latencies and throughput of workload to stdout.
+ *
+ * @param state a state of parent process
+ * @param kind measured workload
+ * @param payload_len length of payload of messages
+ * @param latencies latencies of iterations in nanoseconds, sorted by this function
+ * @param count count of iterations
+ * @param elapsed total time of iterations in nanoseconds
+ */
+void bench_report(ProcessState *state, BenchKind kind, size_t payload_len,
+                  long long *latencies, long count, long long elapsed);
+
+/**
+ * Compares latencies for qsort().
+ */
+int compare_latencies(const void *a, const void *b);
+
+int execute_bench(ProcessState *state, BenchKind kind, long iterations) {
+    Message *message;
+    long long *latencies;
+    size_t payload_len;
+    long warmup;
+    int result;
+
+    message = calloc(1, sizeof(Message));
+    latencies = state->id == PARENT_ID ? malloc(sizeof(long long) * (size_t) (iterations > 0 ? iterations : 1)) : NULL;
+    if (!message || (state->id == PARENT_ID && !latencies)) {
+        fprintf(stderr, "(%d) Failed to allocate benchmark buffers\n", state->id);
+        free(message);
+        free(latencies);
+        cleanup_channels(state);
+        return 1;
+    }
+
+    warmup = iterations / 10;
+    payload_len = 0;
+    result = 0;
+
+    while (!result) {
+        BenchKind current;
+
+        message->s_header.s_magic = MESSAGE_MAGIC;
+        message->s_header.s_type = STARTED;
+        message->s_header.s_payload_len = (uint16_t) payload_len;
+        message->s_header.s_local_time = 0;
+
+        for (current = BENCH_PINGPONG; !result && current < BENCH_ALL; ++current) {
+            long long started;
+
+            if (kind != BENCH_ALL && kind != current) {
+                continue;
+            }
+            if ((current == BENCH_PINGPONG || current == BENCH_STREAM) && state->processes_count < 1) {
+                continue;
+            }
+            if (current == BENCH_STREAM && payload_len != MAX_PAYLOAD_LEN) {
+                continue;
+            }
+
+            if ((result = bench_workload(state, current, message, warmup, NULL))) {
+                break;
+            }
+            started = monotonic_ns();
+            if ((result = bench_workload(state, current, message, iterations, latencies))) {
+                break;
+            }
+            if (state->id == PARENT_ID) {
+                bench_report(state, current, current == BENCH_STREAM ? BENCH_STREAM_LEN : payload_len,
+                             latencies, iterations, monotonic_ns() - started);
+            }
+        }
+
+        if (payload_len == MAX_PAYLOAD_LEN) {
+            break;
+        }
+        payload_len = payload_len ? payload_len * 4 : 16;
+        if (payload_len > MAX_PAYLOAD_LEN) {
+            payload_len = MAX_PAYLOAD_LEN;
+        }
+    }
+
+    if (result) {
+        fprintf(stderr, "(%d) Failed to run benchmark: payload_len=%zu\n", state->id, payload_len);
+    }
+
+    free(message);
+    free(latencies);
+    cleanup_channels(state);
+
+    return result;
+}
+
+int bench_workload(ProcessState *state, BenchKind kind, Message *message, long count, long long *latencies) {
+    Message *received, ack;
+    char *data;
+    long i;
+
+    received = malloc(sizeof(Message));
+    data = kind == BENCH_STREAM ? malloc(2 * BENCH_STREAM_LEN) : NULL;
+    if (!received || (kind == BENCH_STREAM && !data)) {
+        fprintf(stderr, "(%d) Failed to allocate message\n", state->id);
+        free(received);
+        free(data);
+        return 1;
+    }
+    for (i = 0; data && i < BENCH_STREAM_LEN; ++i) {
+        data[i] = (char) (i * 31 + i / MAX_PAYLOAD_LEN);
+    }
+    ack.s_header.s_magic = MESSAGE_MAGIC;
+    ack.s_header.s_type = ACK;
+    ack.s_header.s_payload_len = 0;
+    ack.s_header.s_local_time = 0;
+
+    for (i = 0; i < count; ++i) {
+        long long started;
+        int result;
+
+        started = monotonic_ns();
+        result = 0;
+
+        switch (kind) {
+            case BENCH_PINGPONG:
+                if (state->id == PARENT_ID) {
+                    result = send(state, 1, message) || receive(state, 1, received);
+                } else if (state->id == 1) {
+                    result = receive(state, PARENT_ID, received) || send(state, PARENT_ID, received);
+                }
+                break;
+            case BENCH_MULTICAST:
+                if (state->id == PARENT_ID) {
+                    result = send_multicast(state, message) || receive_from_all_any(state, ACK);
+                } else {
+                    result = receive(state, PARENT_ID, received) || send(state, PARENT_ID, &ack);
+                }
+                break;
+            case BENCH_STREAM:
+                result = bench_stream(state, message->s_header.s_type, data);
+                break;
+            default:
+                result = bench_barrier(state, message, received);
+        }
+
+        if (result) {
+            fprintf(stderr, "(%d) Failed to run benchmark iteration: bench=%s iteration=%ld\n",
+                    state->id, bench_names[kind], i);
+            free(received);
+            free(data);
+            return 1;
+        }
+        if (latencies) {
+            latencies[i] = monotonic_ns() - started;
+        }
+    }
+
+    free(received);
+    free(data);
+    return 0;
+}
+
+int bench_barrier(ProcessState *state, const Message *message, Message *received) {
+    char pending[state->processes_count + 1];
+    long remaining;
+
+    if (state->barrier_kind == BARRIER_DISSEMINATION) {
+        return barrier(state, message);
+    }
+
+    if (send_multicast(state, message)) {
+        return 1;
+    }
+
+    remaining = state->processes_count;
+    for (int id = 0; id <= state->processes_count; ++id) {
+        pending[id] = id != state->id;
+    }
+    while (remaining > 0) {
+        if (receive_any_of(state, pending, received)) {
+            return 2;
+        }
+        pending[state->last_from] = 0;
+        --remaining;
+    }
+
+    return 0;
+}
+
+int bench_stream(ProcessState *state, int16_t type, char *data) {
+    size_t size;
+
+    if (state->id == PARENT_ID) {
+        if (send_stream(state, 1, type, data, BENCH_STREAM_LEN)
+            || receive_stream(state, 1, type, &data[BENCH_STREAM_LEN], BENCH_STREAM_LEN, &size)) {
+            return 1;
+        }
+        if (size != BENCH_STREAM_LEN || memcmp(data, &data[BENCH_STREAM_LEN], BENCH_STREAM_LEN) != 0) {
+            fprintf(stderr, "(%d) Echoed stream differs from sent one: size=%zu\n", state->id, size);
+            return 2;
+        }
+    } else if (state->id == 1) {
+        if (receive_stream(state, PARENT_ID, type, data, BENCH_STREAM_LEN, &size)
+            || send_stream(state, PARENT_ID, type, data, size)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+long bench_messages(ProcessState *state, BenchKind kind) {
+    long total, rounds;
+
+    total = state->processes_count + 1;
+    switch (kind) {
+        case BENCH_PINGPONG:
+            return 2;
+        case BENCH_MULTICAST:
+            return 2 * state->processes_count;
+        case BENCH_STREAM:
+            return 2 * (1 + (BENCH_STREAM_LEN + MAX_PAYLOAD_LEN - 1) / MAX_PAYLOAD_LEN);
+        default:
+            if (state->barrier_kind == BARRIER_ALL_TO_ALL) {
+                return total * (total - 1);
+            }
+            rounds = 0;
+            while ((1L << rounds) < total) {
+                ++rounds;
+            }
+            return total * rounds;
+    }
+}
+
+void bench_report(ProcessState *state, BenchKind kind, size_t payload_len,
+                  long long *latencies, long count, long long elapsed) {
+    double p50, p99, p999, throughput;
+
+    p50 = p99 = p999 = throughput = 0;
+    if (count > 0) {
+        qsort(latencies, (size_t) count, sizeof(long long), compare_latencies);
+        p50 = latencies[(count - 1) * 500 / 1000] / 1000.0;
+        p99 = latencies[(count - 1) * 990 / 1000] / 1000.0;
+        p999 = latencies[(count - 1) * 999 / 1000] / 1000.0;
+    }
+    if (elapsed > 0) {
+        throughput = (double) bench_messages(state, kind) * count * 1e9 / elapsed;
+    }
+
+    printf("bench=%s transport=%s barrier=%s processes=%ld batch=%zu payload=%zu iterations=%ld "
+           "p50_us=%.3f p99_us=%.3f p999_us=%.3f msgs_per_sec=%.0f\n",
+           bench_names[kind], transport_names[state->transport], barrier_names[state->barrier_kind],
+           state->processes_count, state->batch_limit, payload_len, count, p50, p99, p999, throughput);
+    fflush(stdout);
+}
+
+int compare_latencies(const void *a, const void *b) {
+    long long left, right;
+
+    left = *(const long long *) a;
+    right = *(const long long *) b;
+    return (left > right) - (left < right);
+}
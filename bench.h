@@ -0,0 +1,24 @@
+#include "core.h"
+
+#ifndef PA1_BENCH_H
+#define PA1_BENCH_H
+
+enum {
+    BENCH_DEFAULT_ITERATIONS = 1000, ///< Default count of measured iterations of every workload
+    BENCH_STREAM_LEN = 1 << 20       ///< Size of buffer exchanged as stream by stream workload
+};
+
+/**
+ * Runs benchmark workloads for every payload size from 0 to MAX_PAYLOAD_LEN
+ * instead of phases. Parent measures every iteration and prints p50, p99 and
+ * p999 latencies and throughput of every workload to stdout. Stream workload
+ * doesn't depend on payload size, so it runs once with BENCH_STREAM_LEN bytes.
+ *
+ * @param state a state of current process
+ * @param kind workload to run
+ * @param iterations count of measured iterations of every workload
+ * @return 0 if success
+ */
+int execute_bench(ProcessState *state, BenchKind kind, long iterations);
+
+#endif //PA1_BENCH_H
@@ -0,0 +1,19 @@
+#include <time.h>
+
+#ifndef PA1_CLOCK_H
+#define PA1_CLOCK_H
+
+/**
+ * Returns monotonic time in nanoseconds, the same for all processes and
+ * threads of run.
+ *
+ * @return current time
+ */
+static inline long long monotonic_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#endif //PA1_CLOCK_H
@@ -0,0 +1,196 @@
+#include "codec.h"
+
+/**
+ * Appends varint to buffer if it fits.
+ *
+ * @param buffer buffer for varint
+ * @param offset offset of varint in buffer, advanced past it
+ * @param limit size of buffer
+ * @param value value to append
+ * @return 0 if varint fits into buffer
+ */
+int put_varint(unsigned char *buffer, size_t *offset, size_t limit, uint32_t value);
+
+/**
+ * Reads varint from buffer. Varint with redundant trailing zero group or
+ * value beyond 32 bits is rejected, so every value has single encoding.
+ *
+ * @param buffer buffer with varint
+ * @param offset offset of varint in buffer, advanced past it
+ * @param size size of buffer
+ * @param value read value
+ * @return 0 if varint is complete
+ */
+int get_varint(const unsigned char *buffer, size_t *offset, size_t size, uint32_t *value);
+
+long decode_headers(const unsigned char *data, size_t size, MessageHeader *headers, long limit, size_t *consumed) {
+    MessageHeader header;
+    size_t offset;
+    long count;
+
+    offset = 0;
+    count = 0;
+    while (count < limit && size - offset >= sizeof(MessageHeader)) {
+        if (decode_header(&data[offset], &header)) {
+            *consumed = offset;
+            return -1;
+        }
+        if (size - offset - sizeof(MessageHeader) < header.s_payload_len) {
+            break;
+        }
+        if (headers) {
+            headers[count] = header;
+        }
+        offset += sizeof(MessageHeader) + header.s_payload_len;
+        ++count;
+    }
+
+    *consumed = offset;
+    return count;
+}
+
+size_t compress_payload(const char *payload, size_t size, unsigned char *packed) {
+    const unsigned char *bytes;
+    uint16_t previous[2];
+    size_t words, offset, i;
+
+    if (size < COMPRESS_THRESHOLD) {
+        return 0;
+    }
+
+    bytes = (const unsigned char *) payload;
+    words = size / 2;
+    previous[0] = previous[1] = 0;
+    offset = 0;
+    if (put_varint(packed, &offset, size, (uint32_t) size)) {
+        return 0;
+    }
+
+    for (i = 0; i < words;) {
+        uint16_t word, delta;
+
+        word = (uint16_t) (bytes[i * 2] | bytes[i * 2 + 1] << 8);
+        delta = (uint16_t) (word - previous[i & 1]);
+        if (!delta) {
+            size_t run;
+
+            for (run = 1; i + run < words; ++run) {
+                if ((uint16_t) (bytes[(i + run) * 2] | bytes[(i + run) * 2 + 1] << 8) != previous[(i + run) & 1]) {
+                    break;
+                }
+            }
+            if (put_varint(packed, &offset, size, (uint32_t) run << 1 | 1)) {
+                return 0;
+            }
+            i += run;
+            continue;
+        }
+
+        if (put_varint(packed, &offset, size, (uint32_t) ((uint16_t) (delta << 1) ^ (uint16_t) -(delta >> 15)) << 1)) {
+            return 0;
+        }
+        previous[i & 1] = word;
+        ++i;
+    }
+
+    if (size & 1) {
+        if (offset >= size) {
+            return 0;
+        }
+        packed[offset++] = bytes[size - 1];
+    }
+
+    return offset < size ? offset : 0;
+}
+
+int decompress_payload(const unsigned char *packed, size_t size, char *payload, uint16_t *payload_len) {
+    unsigned char *bytes;
+    uint16_t previous[2];
+    uint32_t length, token;
+    size_t words, offset, i;
+
+    offset = 0;
+    if (get_varint(packed, &offset, size, &length) || length > MAX_PAYLOAD_LEN) {
+        return 1;
+    }
+
+    bytes = (unsigned char *) payload;
+    words = length / 2;
+    previous[0] = previous[1] = 0;
+    for (i = 0; i < words;) {
+        if (get_varint(packed, &offset, size, &token)) {
+            return 2;
+        }
+        if (token & 1) {
+            size_t run;
+
+            run = token >> 1;
+            if (!run || run > words - i) {
+                return 3;
+            }
+            for (; run > 0; --run, ++i) {
+                bytes[i * 2] = (unsigned char) previous[i & 1];
+                bytes[i * 2 + 1] = (unsigned char) (previous[i & 1] >> 8);
+            }
+        } else {
+            uint16_t zigzag;
+
+            if (token >> 1 > UINT16_MAX) {
+                return 3;
+            }
+            zigzag = (uint16_t) (token >> 1);
+            previous[i & 1] = (uint16_t) (previous[i & 1] + (uint16_t) ((zigzag >> 1) ^ -(zigzag & 1)));
+            bytes[i * 2] = (unsigned char) previous[i & 1];
+            bytes[i * 2 + 1] = (unsigned char) (previous[i & 1] >> 8);
+            ++i;
+        }
+    }
+
+    if (length & 1) {
+        if (offset >= size) {
+            return 4;
+        }
+        bytes[length - 1] = packed[offset++];
+    }
+    if (offset != size) {
+        return 5;
+    }
+
+    *payload_len = (uint16_t) length;
+    return 0;
+}
+
+int put_varint(unsigned char *buffer, size_t *offset, size_t limit, uint32_t value) {
+    do {
+        if (*offset >= limit) {
+            return 1;
+        }
+        buffer[(*offset)++] = (unsigned char) ((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+
+    return 0;
+}
+
+int get_varint(const unsigned char *buffer, size_t *offset, size_t size, uint32_t *value) {
+    int shift;
+
+    *value = 0;
+    for (shift = 0; shift < 32; shift += 7) {
+        unsigned char byte;
+
+        if (*offset >= size) {
+            return 1;
+        }
+        byte = buffer[(*offset)++];
+        if ((shift && !byte) || (shift == 28 && byte > 0x0F)) {
+            return 1;
+        }
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,152 @@
+#include <stddef.h>
+#include <string.h>
+#include "core.h"
+
+#ifndef PA1_CODEC_H
+#define PA1_CODEC_H
+
+/*
+ * Header is sent as four big-endian 16-bit fields: magic, type, payload
+ * length and local time. Codec loads and stores it as single 64-bit word.
+ * Payload length never exceeds 12 bits, so its highest bit flags compressed
+ * payload.
+ *
+ * Compressed payload is a varint of original length followed by varint
+ * tokens, one per little-endian 16-bit word of payload. Every word is
+ * delta-encoded against the word two positions before, so both fields of
+ * balance steps are compared with the same field of the previous step.
+ * Token is zigzag delta shifted left by one, or length of run of zero deltas
+ * shifted left by one with the lowest bit set. Odd byte is appended as is.
+ *
+ * Compression reduces only bytes on the wire: payload is decompressed into
+ * Message, so it never exceeds MAX_PAYLOAD_LEN either way. Data longer than
+ * single message, like balance history, is sent as stream, whose fragments
+ * are compressed one by one.
+ */
+
+enum {
+    HEADER_COMPRESSED = 0x8000, ///< Flag in payload length field of encoded header, payload is compressed
+    COMPRESS_THRESHOLD = 128    ///< Minimal length of payload to compress
+};
+
+/**
+ * Converts 64-bit word between host and big-endian byte order.
+ *
+ * @param word word to convert
+ * @return converted word
+ */
+static inline uint64_t header_word_swap(uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+/**
+ * Encodes message header with given time.
+ *
+ * @param buffer a buffer for encoded header of sizeof(MessageHeader) bytes
+ * @param header a header to encode, its time is ignored
+ * @param local_time Lamport time of sender
+ */
+static inline void encode_header(unsigned char *buffer, const MessageHeader *header, timestamp_t local_time) {
+    uint64_t word;
+
+    word = (uint64_t) header->s_magic << 48
+           | (uint64_t) (uint16_t) header->s_type << 32
+           | (uint64_t) header->s_payload_len << 16
+           | (uint16_t) local_time;
+    word = header_word_swap(word);
+    memcpy(buffer, &word, sizeof(word));
+}
+
+/**
+ * Decodes message header and validates magic and payload length in the same
+ * step.
+ *
+ * @param buffer a buffer with encoded header
+ * @param header a header that must be decoded
+ * @return 0 if header is valid
+ */
+static inline int decode_header(const unsigned char *buffer, MessageHeader *header) {
+    uint64_t word;
+
+    memcpy(&word, buffer, sizeof(word));
+    word = header_word_swap(word);
+    header->s_magic = (uint16_t) (word >> 48);
+    header->s_type = (int16_t) (uint16_t) (word >> 32);
+    header->s_payload_len = (uint16_t) (word >> 16) & (uint16_t) ~HEADER_COMPRESSED;
+    header->s_local_time = (timestamp_t) (uint16_t) word;
+
+    return header->s_magic != MESSAGE_MAGIC || header->s_payload_len > MAX_PAYLOAD_LEN;
+}
+
+/**
+ * Returns type of encoded header without decoding other fields.
+ *
+ * @param buffer a buffer with encoded header
+ * @return type of message
+ */
+static inline int16_t encoded_type(const unsigned char *buffer) {
+    return (int16_t) (buffer[2] << 8 | buffer[3]);
+}
+
+/**
+ * Checks whether payload of encoded header is compressed.
+ *
+ * @param buffer a buffer with encoded header
+ * @return non-zero if payload is compressed
+ */
+static inline int header_compressed(const unsigned char *buffer) {
+    return buffer[4] & HEADER_COMPRESSED >> 8;
+}
+
+/**
+ * Replaces payload length of encoded header with length of compressed
+ * payload and flags it as compressed.
+ *
+ * @param buffer a buffer with encoded header
+ * @param packed_len length of compressed payload
+ */
+static inline void mark_compressed(unsigned char *buffer, size_t packed_len) {
+    buffer[4] = (unsigned char) (HEADER_COMPRESSED >> 8 | packed_len >> 8);
+    buffer[5] = (unsigned char) packed_len;
+}
+
+/**
+ * Compresses payload if it is not shorter than COMPRESS_THRESHOLD and
+ * compressed payload is shorter than original.
+ *
+ * @param payload payload to compress
+ * @param size length of payload
+ * @param packed buffer for compressed payload of at least size bytes
+ * @return length of compressed payload or 0 if payload must be sent as is
+ */
+size_t compress_payload(const char *payload, size_t size, unsigned char *packed);
+
+/**
+ * Restores payload compressed by compress_payload().
+ *
+ * @param packed compressed payload
+ * @param size length of compressed payload
+ * @param payload buffer for payload of MAX_PAYLOAD_LEN bytes
+ * @param payload_len length of restored payload
+ * @return 0 if success, non-zero if compressed payload is corrupted
+ */
+int decompress_payload(const unsigned char *packed, size_t size, char *payload, uint16_t *payload_len);
+
+/**
+ * Decodes and validates headers of consecutive frames in buffer, e.g. all
+ * frames read by single read() of batched channel.
+ *
+ * @param data buffer with frames of encoded header and payload
+ * @param size count of bytes in buffer
+ * @param headers decoded headers, NULL to only validate frames
+ * @param limit maximum count of frames to decode
+ * @param consumed count of bytes of decoded complete frames
+ * @return count of decoded complete frames, -1 if header of the next frame is invalid
+ */
+long decode_headers(const unsigned char *data, size_t size, MessageHeader *headers, long limit, size_t *consumed);
+
+#endif //PA1_CODEC_H
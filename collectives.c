@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include "distributed.h"
+#include "counters.h"
+
+int barrier(ProcessState *state, const Message *message) {
+    Message received;
+    long total, distance;
+    long long started;
+
+    total = state->processes_count + 1;
+    started = counters_clock(state);
+
+    for (distance = 1; distance < total; distance <<= 1) {
+        local_id to, from;
+
+        to = (local_id) ((state->id + distance) % total);
+        from = (local_id) ((state->id - distance + total) % total);
+
+        if (send(state, to, message)) {
+            fprintf(stderr, "(%d) Failed to send barrier message: to=%d\n", state->id, to);
+            return 1;
+        }
+        if (receive(state, from, &received)) {
+            fprintf(stderr, "(%d) Failed to receive barrier message: from=%d\n", state->id, from);
+            return 2;
+        }
+        if (received.s_header.s_type != message->s_header.s_type) {
+            fprintf(stderr, "(%d) Message has incorrect type: type=%d\n", state->id, received.s_header.s_type);
+            return 3;
+        }
+        count_arrival(state, from, started);
+    }
+
+    count_barrier(state, started);
+    return 0;
+}
+
+int tree_broadcast(ProcessState *state, local_id root, Message *message) {
+    long total, rank, mask;
+
+    total = state->processes_count + 1;
+    rank = (state->id - root + total) % total;
+
+    for (mask = 1; mask < total; mask <<= 1) {
+        if (rank & mask) {
+            local_id from = (local_id) ((rank - mask + root) % total);
+
+            if (receive(state, from, message)) {
+                fprintf(stderr, "(%d) Failed to receive broadcast message: from=%d\n", state->id, from);
+                return 1;
+            }
+            break;
+        }
+    }
+
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (rank + mask < total) {
+            local_id to = (local_id) ((rank + mask + root) % total);
+
+            if (send(state, to, message)) {
+                fprintf(stderr, "(%d) Failed to send broadcast message: to=%d\n", state->id, to);
+                return 2;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "connections.h"
+#include "detector.h"
+#include "sockets.h"
+#include "counters.h"
+
+/**
+ * Sends descriptor of channel to peer over control channel.
+ *
+ * @param state a state of parent process
+ * @param to identifier of child that receives descriptor
+ * @param peer identifier of process on the other side of channel
+ * @param descriptor descriptor to send, negative to refuse channel
+ * @return 0 if success
+ */
+int send_descriptor(ProcessState *state, local_id to, local_id peer, int descriptor);
+
+/**
+ * Handles readable control channel: parent creates requested channel or
+ * forgets finished child, child installs received channel.
+ *
+ * @param state a state of current process
+ * @param from identifier of process on the other side of control channel
+ * @return 1 if channels changed, 0 if nothing changed, negative on error
+ */
+int serve_control(ProcessState *state, local_id from);
+
+/**
+ * Installs descriptor of channel to peer.
+ *
+ * @param state a state of current process
+ * @param peer identifier of peer process
+ * @param descriptor descriptor of channel
+ * @return 0 if success
+ */
+int install_channel(ProcessState *state, local_id peer, int descriptor);
+
+int init_connections(ProcessState *state, ChildSockets *sockets) {
+    long total;
+    int id;
+
+    total = state->processes_count + 1;
+    state->connected_pairs = calloc((size_t) (total * total), sizeof(char));
+    if (!state->connected_pairs) {
+        log_pipe(state, "Failed to allocate connected pairs\n");
+        return 1;
+    }
+
+    for (id = 1; id < total; ++id) {
+        int data[2], control[2];
+
+        if (open_socket_pair(data, 0)) {
+            log_pipe(state, "Failed to create data sockets: to=%d error=%s\n", id, strerror(errno));
+            break;
+        }
+        if (open_socket_pair(control, 1)) {
+            log_pipe(state, "Failed to create control sockets: to=%d error=%s\n", id, strerror(errno));
+            close(data[0]);
+            close(data[1]);
+            break;
+        }
+
+        sockets[id].parent_data = data[0];
+        sockets[id].child_data = data[1];
+        sockets[id].parent_control = control[0];
+        sockets[id].child_control = control[1];
+        state->connected_pairs[id] = state->connected_pairs[id * total] = 1;
+
+        log_pipe(state, "Create sockets: from=%d to=%d data=[%d, %d] control=[%d, %d]\n",
+                 PARENT_ID, id, data[0], data[1], control[0], control[1]);
+    }
+
+    if (id < total) {
+        while (--id > 0) {
+            close(sockets[id].parent_data);
+            close(sockets[id].child_data);
+            close(sockets[id].parent_control);
+            close(sockets[id].child_control);
+        }
+        free(state->connected_pairs);
+        state->connected_pairs = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+void close_connections(ProcessState *state, ChildSockets *sockets) {
+    int id;
+
+    for (id = 1; id <= state->processes_count; ++id) {
+        log_pipe(state, "Close sockets: from=%d to=%d data=[%d, %d] control=[%d, %d]\n",
+                 PARENT_ID, id, sockets[id].parent_data, sockets[id].child_data,
+                 sockets[id].parent_control, sockets[id].child_control);
+        close(sockets[id].parent_data);
+        close(sockets[id].child_data);
+        close(sockets[id].parent_control);
+        close(sockets[id].child_control);
+    }
+}
+
+int prepare_connections(ProcessState *state, ChildSockets *sockets) {
+    int id;
+
+    for (id = 0; id <= state->processes_count; ++id) {
+        state->reading_pipes[id] = state->writing_pipes[id] = -1;
+        state->control_sockets[id] = -1;
+        state->requested[id] = 0;
+    }
+
+    for (id = 1; id <= state->processes_count; ++id) {
+        if (state->id == PARENT_ID) {
+            state->control_sockets[id] = sockets[id].parent_control;
+            if (install_channel(state, (local_id) id, sockets[id].parent_data)) {
+                return 1;
+            }
+            log_pipe(state, "(%d) Close child sockets: to=%d descriptors=[%d, %d]\n",
+                     state->id, id, sockets[id].child_data, sockets[id].child_control);
+            close(sockets[id].child_data);
+            close(sockets[id].child_control);
+        } else if (state->id == id) {
+            state->control_sockets[PARENT_ID] = sockets[id].child_control;
+            if (install_channel(state, PARENT_ID, sockets[id].child_data)) {
+                return 1;
+            }
+            log_pipe(state, "(%d) Close parent sockets: descriptors=[%d, %d]\n",
+                     state->id, sockets[id].parent_data, sockets[id].parent_control);
+            close(sockets[id].parent_data);
+            close(sockets[id].parent_control);
+        } else {
+            log_pipe(state, "(%d) Close unused sockets: to=%d descriptors=[%d, %d, %d, %d]\n",
+                     state->id, id, sockets[id].parent_data, sockets[id].child_data,
+                     sockets[id].parent_control, sockets[id].child_control);
+            close(sockets[id].parent_data);
+            close(sockets[id].child_data);
+            close(sockets[id].parent_control);
+            close(sockets[id].child_control);
+        }
+    }
+
+    return 0;
+}
+
+int request_connection(ProcessState *state, local_id peer) {
+    if (state->reading_pipes[peer] >= 0 || state->requested[peer]) {
+        return 0;
+    }
+    if (state->id == PARENT_ID || peer == PARENT_ID || state->dead[peer]) {
+        fprintf(stderr, "(%d) No channel to process: peer=%d\n", state->id, peer);
+        return 1;
+    }
+
+    if (write(state->control_sockets[PARENT_ID], &peer, sizeof(peer)) != sizeof(peer)) {
+        fprintf(stderr, "(%d) Failed to request channel: peer=%d error=%s\n", state->id, peer, strerror(errno));
+        return 1;
+    }
+    state->requested[peer] = 1;
+
+    return 0;
+}
+
+int connect_peer(ProcessState *state, local_id peer) {
+    if (request_connection(state, peer)) {
+        return 1;
+    }
+    while (state->reading_pipes[peer] < 0) {
+        if (state->dead[peer] || poll_connections(state, NULL, 0, -1) < 0) {
+            return 2;
+        }
+    }
+    return 0;
+}
+
+int poll_connections(ProcessState *state, struct pollfd *fds, nfds_t count, int timeout) {
+    struct pollfd all[count + state->processes_count + 1];
+    local_id controls[state->processes_count + 1];
+    nfds_t total, i;
+
+    total = count;
+    for (i = 0; i < count; ++i) {
+        all[i] = fds[i];
+    }
+    for (i = 0; i <= (nfds_t) state->processes_count; ++i) {
+        if (state->control_sockets[i] >= 0) {
+            all[total].fd = state->control_sockets[i];
+            all[total].events = POLLIN;
+            controls[total - count] = (local_id) i;
+            ++total;
+        }
+    }
+    if (!total) {
+        fprintf(stderr, "(%d) Nothing to wait for\n", state->id);
+        return -1;
+    }
+
+    for (;;) {
+        int changed, ready, polled;
+
+        count_poll(state);
+        while ((polled = poll(all, total, timeout)) < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "(%d) Failed to poll sockets: error=%s\n", state->id, strerror(errno));
+                return -1;
+            }
+        }
+        if (!polled) {
+            for (i = 0; i < count; ++i) {
+                fds[i].revents = 0;
+            }
+            return 2;
+        }
+
+        changed = 0;
+        for (i = count; i < total; ++i) {
+            if (all[i].revents) {
+                int result;
+
+                if ((result = serve_control(state, controls[i - count])) < 0) {
+                    return result;
+                }
+                changed |= result;
+            }
+        }
+
+        ready = 0;
+        for (i = 0; i < count; ++i) {
+            fds[i].revents = all[i].revents;
+            ready |= all[i].revents != 0;
+        }
+        if (ready) {
+            return 0;
+        }
+        if (changed) {
+            return 1;
+        }
+    }
+}
+
+void cleanup_connections(ProcessState *state) {
+    int id;
+
+    for (id = 0; id <= state->processes_count; ++id) {
+        if (state->reading_pipes[id] >= 0) {
+            log_pipe(state, "(%d) Close socket: peer=%d descriptor=%d\n", state->id, id, state->reading_pipes[id]);
+            close(state->reading_pipes[id]);
+            state->reading_pipes[id] = state->writing_pipes[id] = -1;
+        }
+    }
+
+    if (state->id == PARENT_ID) {
+        int opened;
+
+        do {
+            opened = 0;
+            for (id = 1; id <= state->processes_count; ++id) {
+                opened |= state->control_sockets[id] >= 0;
+            }
+        } while (opened && poll_connections(state, NULL, 0, -1) >= 0);
+        free(state->connected_pairs);
+        state->connected_pairs = NULL;
+    }
+
+    for (id = 0; id <= state->processes_count; ++id) {
+        if (state->control_sockets[id] >= 0) {
+            log_pipe(state, "(%d) Close control socket: peer=%d descriptor=%d\n",
+                     state->id, id, state->control_sockets[id]);
+            close(state->control_sockets[id]);
+            state->control_sockets[id] = -1;
+        }
+    }
+}
+
+int serve_control(ProcessState *state, local_id from) {
+    local_id peer;
+    ssize_t received;
+
+    if (state->id != PARENT_ID) {
+        int descriptor;
+
+        if (receive_descriptor_tagged(state->control_sockets[from], &peer, &descriptor) <= 0
+            || peer < 0 || peer > state->processes_count) {
+            fprintf(stderr, "(%d) Failed to receive channel: error=%s\n", state->id, strerror(errno));
+            return -1;
+        }
+
+        if (descriptor < 0) {
+            fprintf(stderr, "(%d) Channel was refused by parent: peer=%d\n", state->id, peer);
+            state->requested[peer] = 0;
+            state->dead[peer] = 1;
+            return 1;
+        }
+        log_pipe(state, "(%d) Receive socket: peer=%d descriptor=%d\n", state->id, peer, descriptor);
+        return install_channel(state, peer, descriptor) ? -1 : 1;
+    }
+
+    do {
+        received = read(state->control_sockets[from], &peer, sizeof(peer));
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) {
+        log_pipe(state, "(%d) Close control socket: peer=%d descriptor=%d\n",
+                 state->id, from, state->control_sockets[from]);
+        close(state->control_sockets[from]);
+        state->control_sockets[from] = -1;
+        return 1;
+    }
+
+    if (peer <= PARENT_ID || peer > state->processes_count || peer == from) {
+        fprintf(stderr, "(%d) Invalid channel request: from=%d peer=%d\n", state->id, from, peer);
+    } else if (!state->connected_pairs[from * (state->processes_count + 1) + peer]) {
+        int descriptors[2];
+
+        if (open_socket_pair(descriptors, 0)) {
+            fprintf(stderr, "(%d) Failed to create sockets: from=%d to=%d error=%s\n",
+                    state->id, from, peer, strerror(errno));
+            return -1;
+        }
+        log_pipe(state, "Create socket pair: from=%d to=%d descriptors=[%d, %d]\n",
+                 from, peer, descriptors[0], descriptors[1]);
+
+        if (send_descriptor(state, peer, from, descriptors[1])) {
+            send_descriptor(state, from, peer, -1);
+        } else if (!send_descriptor(state, from, peer, descriptors[0])) {
+            state->connected_pairs[from * (state->processes_count + 1) + peer] = 1;
+            state->connected_pairs[peer * (state->processes_count + 1) + from] = 1;
+        }
+        close(descriptors[0]);
+        close(descriptors[1]);
+    }
+
+    return 1;
+}
+
+int send_descriptor(ProcessState *state, local_id to, local_id peer, int descriptor) {
+    if (state->control_sockets[to] < 0) {
+        fprintf(stderr, "(%d) Process has already finished: to=%d\n", state->id, to);
+        return 1;
+    }
+
+    if (send_descriptor_tagged(state->control_sockets[to], peer, descriptor)) {
+        fprintf(stderr, "(%d) Failed to send channel: to=%d peer=%d error=%s\n",
+                state->id, to, peer, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+int install_channel(ProcessState *state, local_id peer, int descriptor) {
+    if ((state->nonblocking || detector_timeout(state) >= 0) && fcntl(descriptor, F_SETFL, O_NONBLOCK) == -1) {
+        log_pipe(state, "(%d) Failed to switch socket to non-blocking mode: peer=%d error=%s\n",
+                 state->id, peer, strerror(errno));
+        close(descriptor);
+        return 1;
+    }
+
+    state->reading_pipes[peer] = state->writing_pipes[peer] = descriptor;
+    state->requested[peer] = 0;
+
+    return 0;
+}
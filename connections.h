@@ -0,0 +1,86 @@
+#include <poll.h>
+#include "core.h"
+
+#ifndef PA1_CONNECTIONS_H
+#define PA1_CONNECTIONS_H
+
+/**
+ * Descriptors created by parent for single child before fork.
+ */
+typedef struct {
+    int parent_data;    ///< Parent endpoint of data channel between parent and child
+    int parent_control; ///< Parent endpoint of control channel
+    int child_data;     ///< Child endpoint of data channel between parent and child
+    int child_control;  ///< Child endpoint of control channel
+} ChildSockets;
+
+/**
+ * Creates data and control socket pairs between parent and every child.
+ * Channels between children are created later on demand, so only O(N)
+ * descriptors are created before fork.
+ *
+ * @param state a state of parent process
+ * @param sockets descriptors by child identifier
+ * @return 0 if success
+ */
+int init_connections(ProcessState *state, ChildSockets *sockets);
+
+/**
+ * Closes all descriptors created before fork.
+ *
+ * @param state a state of current process
+ * @param sockets descriptors by child identifier
+ */
+void close_connections(ProcessState *state, ChildSockets *sockets);
+
+/**
+ * Keeps descriptors of current process and closes others, O(N) closes
+ * for every process.
+ *
+ * @param state a state of current process
+ * @param sockets descriptors by child identifier
+ * @return 0 if success
+ */
+int prepare_connections(ProcessState *state, ChildSockets *sockets);
+
+/**
+ * Requests channel to peer from parent once. Never blocks.
+ *
+ * @param state a state of current process
+ * @param peer identifier of peer process
+ * @return 0 if success
+ */
+int request_connection(ProcessState *state, local_id peer);
+
+/**
+ * Ensures that channel to peer exists, requesting it from parent and
+ * waiting for it if needed. Fails if parent has refused channel, e.g.
+ * because peer has already finished.
+ *
+ * @param state a state of current process
+ * @param peer identifier of peer process
+ * @return 0 if success
+ */
+int connect_peer(ProcessState *state, local_id peer);
+
+/**
+ * Waits until one of descriptors is ready, serving control channels in the
+ * meantime: parent creates requested channels and children install them.
+ *
+ * @param state a state of current process
+ * @param fds descriptors to wait for
+ * @param count count of descriptors
+ * @param timeout time to wait in milliseconds, negative to wait forever
+ * @return 0 if one of descriptors is ready, 1 if new channel was installed, 2 on timeout, negative on error
+ */
+int poll_connections(ProcessState *state, struct pollfd *fds, nfds_t count, int timeout);
+
+/**
+ * Closes all channels of current process. Parent keeps serving requests
+ * until every child closes its control channel.
+ *
+ * @param state a state of current process
+ */
+void cleanup_connections(ProcessState *state);
+
+#endif //PA1_CONNECTIONS_H
@@ -3,20 +3,238 @@
 
 #include "ipc.h"
 
-#define TOTAL_PROCESSES (MAX_PROCESS_ID + 1)
+/**
+ * Maximum count of child processes, limited by range of local_id.
+ */
+#define MAX_PROCESSES_COUNT INT8_MAX
+
+/**
+ * Count of size classes of message pool.
+ */
+#define POOL_CLASSES_COUNT 4
+
+/**
+ * Count of message types from ipc.h.
+ */
+#define MESSAGE_TYPES_COUNT (CS_RELEASE + 1)
+
+/**
+ * A transport used to deliver messages between processes.
+ */
+typedef enum {
+    TRANSPORT_PIPES = 0, ///< Mesh of unnamed pipes, one per ordered pair of processes
+    TRANSPORT_SHM,       ///< Lock-free rings in shared memory, one per ordered pair of processes
+    TRANSPORT_SOCKETS,   ///< Socket pairs created on demand by parent, one per pair of processes
+    TRANSPORT_QUEUES     ///< Rings of frame pointers in single address space (only for RUNTIME_THREADS)
+} Transport;
+
+/**
+ * A way to run children.
+ */
+typedef enum {
+    RUNTIME_PROCESSES = 0, ///< Every child is forked process
+    RUNTIME_THREADS        ///< Every child is thread of parent process
+} Runtime;
+
+/**
+ * A way to fork child processes.
+ */
+typedef enum {
+    LAUNCHER_SERIAL = 0, ///< Parent forks every child one by one
+    LAUNCHER_TREE        ///< Every process forks children in binomial tree, ceil(log2(N + 1)) levels of forks
+} Launcher;
+
+/**
+ * An algorithm of barriers between phases.
+ */
+typedef enum {
+    BARRIER_ALL_TO_ALL = 0, ///< Every child sends message to all other processes
+    BARRIER_DISSEMINATION   ///< Dissemination barrier in ceil(log2(N + 1)) rounds
+} BarrierKind;
+
+/**
+ * A state of current process in distributed mutual exclusion.
+ */
+typedef enum {
+    CS_IDLE = 0, ///< Process doesn't need critical section
+    CS_WAITING,  ///< Process has requested critical section and waits for replies
+    CS_HELD      ///< Process is in critical section
+} MutexState;
+
+/**
+ * A workload of benchmark run instead of phases.
+ */
+typedef enum {
+    BENCH_NONE = 0,   ///< Phases are executed, no benchmark
+    BENCH_PINGPONG,   ///< Parent and the first child exchange messages one by one
+    BENCH_MULTICAST,  ///< Parent multicasts message and waits for replies of all children
+    BENCH_BARRIER,    ///< All processes pass barrier of chosen algorithm
+    BENCH_STREAM,     ///< Parent and the first child exchange large buffer as stream one by one
+    BENCH_ALL         ///< All workloads one after another
+} BenchKind;
+
+/**
+ * A way to write log records.
+ */
+typedef enum {
+    LOG_DIRECT = 0, ///< Every record is written to log file immediately
+    LOG_BUFFERED,   ///< Records are buffered in process and written in batches
+    LOG_ASYNC       ///< Records are put to shared rings drained by logger process
+} LogMode;
+
+/**
+ * Verbosity of logs, every level includes records of previous levels.
+ */
+typedef enum {
+    LOG_LEVEL_EVENTS = 0, ///< Only events of processes
+    LOG_LEVEL_PIPES       ///< Events and creating or closing of channels
+} LogLevel;
+
+struct ShmRegion;
+struct LogRegion;
+struct Bank;
+union PoolBlock;
+struct Trace;
+struct Detector;
+
+/**
+ * Log of single process.
+ */
+typedef struct {
+    LogMode           mode;        ///< A way to write log records
+    LogLevel          level;       ///< Verbosity of logs
+    int               evt_log;     ///< Events log file descriptor
+    int               pd_log;      ///< Pipes events log file descriptor
+    char             *events;      ///< Buffered events, allocated on first use (only for LOG_BUFFERED)
+    size_t            events_size; ///< Count of buffered bytes of events
+    char             *pipes;       ///< Buffered pipes events, allocated on first use (only for LOG_BUFFERED)
+    size_t            pipes_size;  ///< Count of buffered bytes of pipes events
+    struct LogRegion *region;      ///< Rings drained by logger process (only for LOG_ASYNC)
+    int               logger_pid;  ///< Process identifier of logger process (only in parent)
+} Logger;
+
+/**
+ * Outgoing frames buffered for single destination.
+ */
+typedef struct {
+    unsigned char *data;     ///< Buffered frames, allocated on first use
+    size_t         size;     ///< Count of buffered bytes
+    long long      first_at; ///< Time of the first buffered frame in nanoseconds
+} OutputBatch;
+
+/**
+ * Incoming bytes read from single source but not received yet.
+ */
+typedef struct {
+    unsigned char *data;    ///< Read bytes, allocated on first use
+    size_t         start;   ///< Offset of the first unreceived byte
+    size_t         checked; ///< Offset after the last complete frame with valid header
+    size_t         end;     ///< Offset after the last read byte
+} InputBuffer;
+
+/**
+ * Traffic between current process and single peer.
+ */
+typedef struct {
+    long      sent;           ///< Count of messages sent to peer
+    long long sent_bytes;     ///< Count of bytes of frames sent to peer
+    long      received;       ///< Count of messages received from peer
+    long long received_bytes; ///< Count of bytes of frames received from peer
+    long long wait_ns;        ///< Total time from the start of barriers until message of peer arrived
+} PeerCounters;
+
+/**
+ * Counters of hot path of single process.
+ */
+typedef struct {
+    PeerCounters *peers;                                 ///< Traffic by peer identifier
+    long          sent_by_type[MESSAGE_TYPES_COUNT];     ///< Count of sent messages by type
+    long          received_by_type[MESSAGE_TYPES_COUNT]; ///< Count of received messages by type
+    long          reads;                                 ///< Count of read() calls
+    long          writes;                                ///< Count of write() and writev() calls
+    long          polls;                                 ///< Count of poll() calls
+    long long     blocked_ns;                            ///< Time blocked waiting for input
+    long          barriers;                              ///< Count of passed barriers
+    long long     barrier_ns;                            ///< Total time spent in barriers
+    long long     created_ns;                            ///< Time when counters were allocated
+    long long     startup_ns;                            ///< Time from creation until STARTED of all processes
+    long          jobs;                                  ///< Count of completed jobs
+    long long     jobs_ns;                               ///< Time from the start of the first job until the end of the last
+} Counters;
+
+/**
+ * Free blocks of single process grouped by size class.
+ */
+typedef struct {
+    union PoolBlock *blocks[POOL_CLASSES_COUNT]; ///< Lists of free blocks by size class
+    long             counts[POOL_CLASSES_COUNT]; ///< Count of free blocks by size class
+} MessagePool;
 
 /**
  * A state of current process.
  */
 typedef struct {
-    local_id id;                            ///< Local process identifier
-    long     processes_count;               ///< Total count of processes excluding parent
-    int      reading_pipes[MAX_PROCESS_ID]; ///< Read endpoints of previously created pipes
-    int      writing_pipes[MAX_PROCESS_ID]; ///< Write endpoints of previously created pipes
-    int      evt_log;                       ///< Events log file descriptor
-    int      pd_log;                        ///< Pipes events log file descriptor
+    local_id          id;                              ///< Local process identifier
+    long              processes_count;                 ///< Total count of processes excluding parent
+    int              *reading_pipes;                   ///< Read endpoints of previously created pipes by source
+    int              *writing_pipes;                   ///< Write endpoints of previously created pipes by destination
+    Logger            logger;                          ///< Log of current process
+    Transport         transport;                       ///< Transport used to deliver messages
+    struct ShmRegion *shm;                             ///< Shared memory rings (only for TRANSPORT_SHM)
+    local_id          last_from;                       ///< Sender of message last received by receive_any()
+    timestamp_t       local_time;                      ///< Lamport time, updated by every send and receive
+    size_t            batch_limit;                     ///< Size of batch to flush in bytes, 0 if batching is disabled
+    long              batch_delay;                     ///< Age of batch to flush in microseconds
+    long              dirty_batches;                   ///< Count of non-empty batches
+    OutputBatch      *batches;                         ///< Outgoing batches by destination
+    InputBuffer      *inputs;                          ///< Incoming bytes by source
+    MessagePool       pool;                            ///< Free messages and frames of current process
+    Counters         *counters;                        ///< Counters of hot path, NULL if counters are disabled
+    struct Trace     *trace;                           ///< Rings of trace events, NULL if tracing is disabled
+    struct Detector  *detector;                        ///< Heartbeats of all processes, NULL if detector is disabled
+    char             *dead;                            ///< Non-zero for peers that have failed while awaited
+    int               nonblocking;                     ///< Non-zero if read endpoints are in non-blocking mode
+    int               coalesce;                        ///< Non-zero to coalesce header-only frames without batching
+    BarrierKind       barrier_kind;                    ///< Algorithm of barriers between phases
+    int              *control_sockets;                 ///< Control channels to request channels (only for TRANSPORT_SOCKETS)
+    char             *requested;                       ///< Non-zero for peers with requested channels
+    char             *connected_pairs;                 ///< Matrix of pairs with created channels (only in parent)
+    int               mutexl;                          ///< Non-zero if children enter critical section in loop
+    int               compress;                        ///< Non-zero to compress large payloads before sending
+    MutexState        cs_state;                        ///< State of current process in mutual exclusion
+    timestamp_t       cs_time;                         ///< Lamport time of pending request of critical section
+    char             *deferred;                        ///< Non-zero for peers with deferred replies
+    char             *done_received;                   ///< Non-zero for peers whose DONE was received while serving requests
+    struct Bank      *bank;                            ///< Accounts with balance histories, NULL if bank is disabled
+    long              jobs;                            ///< Count of jobs run over the same channels, 1 without pool
 } ProcessState;
 
+/**
+ * Options of run parsed from command line.
+ */
+typedef struct {
+    long        processes_count;  ///< Count of child processes
+    Runtime     runtime;          ///< A way to run children
+    Launcher    launcher;         ///< A way to fork children (only for RUNTIME_PROCESSES)
+    Transport   transport;        ///< Transport used to deliver messages, TRANSPORT_QUEUES for RUNTIME_THREADS
+    size_t      batch_limit;      ///< Size of batch to flush in bytes, 0 if batching is disabled
+    long        batch_delay;      ///< Age of batch to flush in microseconds
+    int         nonblocking;      ///< Non-zero to read pipes in non-blocking mode
+    int         coalesce;         ///< Non-zero to coalesce header-only frames without batching
+    BarrierKind barrier_kind;     ///< Algorithm of barriers between phases
+    LogMode     log_mode;         ///< A way to write log records
+    LogLevel    log_level;        ///< Verbosity of logs
+    BenchKind   bench;            ///< Workload of benchmark, BENCH_NONE to execute phases
+    long        bench_iterations; ///< Count of measured iterations of every workload
+    int         mutexl;           ///< Non-zero if children enter critical section in loop
+    int         compress;         ///< Non-zero to compress large payloads before sending
+    long        jobs;             ///< Count of jobs run by pool of children, 1 without pool
+    int         counters;         ///< Non-zero to count traffic and dump counters at shutdown
+    int         trace;            ///< Non-zero to record trace events and export them after join
+    int         detector_timeout; ///< Time in milliseconds after which silent process is dead, negative to disable
+    const char *const *balances;  ///< Initial balances of children as arguments, NULL if bank is disabled
+} Options;
+
 /**
  * Logs occurred event to log file.
  *
@@ -26,8 +244,10 @@ typedef struct {
 void log_event(ProcessState *state, const char *message);
 
 /**
- * Logs pipe event, e.g. closing or creating new pipe.
+ * Logs pipe event, e.g. closing or creating new pipe. Does nothing if
+ * verbosity of logs is lower than LOG_LEVEL_PIPES.
  *
+ * @param state a state of current process
  * @param fmt format of log message
  * @param ... message parameters
  */
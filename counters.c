@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "counters.h"
+#include "distributed.h"
+
+int init_counters(ProcessState *state) {
+    state->counters = calloc(1, sizeof(Counters));
+    if (!state->counters) {
+        return 1;
+    }
+    state->counters->peers = calloc((size_t) state->processes_count + 1, sizeof(PeerCounters));
+    if (!state->counters->peers) {
+        free(state->counters);
+        state->counters = NULL;
+        return 1;
+    }
+    state->counters->created_ns = counters_clock(state);
+    return 0;
+}
+
+void release_counters(ProcessState *state) {
+    if (state->counters) {
+        free(state->counters->peers);
+        free(state->counters);
+        state->counters = NULL;
+    }
+}
+
+void dump_counters(ProcessState *state) {
+    Counters *counters;
+    int descriptor, id;
+
+    counters = state->counters;
+    if (!counters) {
+        return;
+    }
+
+    descriptor = open(counters_log, O_WRONLY | O_APPEND | O_CREAT, 0777);
+    if (descriptor < 0) {
+        fprintf(stderr, "(%d) Failed to open counters log!\n", state->id);
+        return;
+    }
+
+    dprintf(descriptor, "counters id=%d reads=%ld writes=%ld polls=%ld blocked_us=%.3f barriers=%ld barrier_us=%.3f\n",
+            state->id, counters->reads, counters->writes, counters->polls, counters->blocked_ns / 1000.0,
+            counters->barriers, counters->barrier_ns / 1000.0);
+    for (id = 0; id <= state->processes_count; ++id) {
+        PeerCounters *peer;
+
+        if (id == state->id) {
+            continue;
+        }
+        peer = &counters->peers[id];
+        dprintf(descriptor, "counters id=%d peer=%d sent=%ld sent_bytes=%lld received=%ld received_bytes=%lld "
+                "wait_us=%.3f\n", state->id, id, peer->sent, peer->sent_bytes, peer->received,
+                peer->received_bytes, peer->wait_ns / 1000.0);
+    }
+    for (id = 0; id < MESSAGE_TYPES_COUNT; ++id) {
+        if (counters->sent_by_type[id] || counters->received_by_type[id]) {
+            dprintf(descriptor, "counters id=%d type=%s sent=%ld received=%ld\n",
+                    state->id, message_type_name(id), counters->sent_by_type[id], counters->received_by_type[id]);
+        }
+    }
+
+    if (state->id == PARENT_ID) {
+        dprintf(descriptor, "counters id=%d startup_us=%.3f jobs=%ld jobs_us=%.3f\n", state->id,
+                counters->startup_ns / 1000.0, counters->jobs, counters->jobs_ns / 1000.0);
+    }
+
+    close(descriptor);
+}
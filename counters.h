@@ -0,0 +1,183 @@
+#include "core.h"
+#include "clock.h"
+
+#ifndef PA1_COUNTERS_H
+#define PA1_COUNTERS_H
+
+static const char * const counters_log = "counters.log";
+
+/**
+ * Allocates counters of current process.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int init_counters(ProcessState *state);
+
+/**
+ * Releases counters of current process.
+ *
+ * @param state a state of current process
+ */
+void release_counters(ProcessState *state);
+
+/**
+ * Appends counters of current process to counters log, one record per line:
+ *
+ *   counters id=1 reads=.. writes=.. polls=.. blocked_us=.. barriers=.. barrier_us=..
+ *   counters id=1 peer=2 sent=.. sent_bytes=.. received=.. received_bytes=.. wait_us=..
+ *   counters id=1 type=CS_REQUEST sent=.. received=..
+ *   counters id=0 startup_us=.. jobs=.. jobs_us=..
+ *
+ * wait_us is total time from the start of barriers until message of peer
+ * has arrived, so the peer with the largest value stalls barriers. Startup
+ * record is written only by parent. Does nothing if counters are disabled.
+ *
+ * @param state a state of current process
+ */
+void dump_counters(ProcessState *state);
+
+/**
+ * Returns monotonic time in nanoseconds if counters are enabled.
+ *
+ * @param state a state of current process
+ * @return current time or 0 if counters are disabled
+ */
+static inline long long counters_clock(ProcessState *state) {
+    return state->counters ? monotonic_ns() : 0;
+}
+
+/**
+ * Counts sent frame.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param type type of message
+ * @param payload_len length of payload
+ */
+static inline void count_sent(ProcessState *state, local_id to, int type, size_t payload_len) {
+    if (state->counters) {
+        ++state->counters->peers[to].sent;
+        state->counters->peers[to].sent_bytes += (long long) (sizeof(MessageHeader) + payload_len);
+        if (type >= 0 && type < MESSAGE_TYPES_COUNT) {
+            ++state->counters->sent_by_type[type];
+        }
+    }
+}
+
+/**
+ * Counts received message. Must be called before payload is decompressed,
+ * so both sides count bytes sent over channel.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param header header of received message
+ */
+static inline void count_received(ProcessState *state, local_id from, const MessageHeader *header) {
+    if (state->counters) {
+        ++state->counters->peers[from].received;
+        state->counters->peers[from].received_bytes += (long long) (sizeof(MessageHeader) + header->s_payload_len);
+        if (header->s_type >= 0 && header->s_type < MESSAGE_TYPES_COUNT) {
+            ++state->counters->received_by_type[header->s_type];
+        }
+    }
+}
+
+/**
+ * Counts issued read() call.
+ *
+ * @param state a state of current process
+ */
+static inline void count_read(ProcessState *state) {
+    if (state->counters) {
+        ++state->counters->reads;
+    }
+}
+
+/**
+ * Counts issued write() or writev() call.
+ *
+ * @param state a state of current process
+ */
+static inline void count_write(ProcessState *state) {
+    if (state->counters) {
+        ++state->counters->writes;
+    }
+}
+
+/**
+ * Counts issued poll() call.
+ *
+ * @param state a state of current process
+ */
+static inline void count_poll(ProcessState *state) {
+    if (state->counters) {
+        ++state->counters->polls;
+    }
+}
+
+/**
+ * Adds time blocked waiting for input since given moment.
+ *
+ * @param state a state of current process
+ * @param started value of counters_clock() before blocking
+ */
+static inline void count_blocked(ProcessState *state, long long started) {
+    if (state->counters) {
+        state->counters->blocked_ns += counters_clock(state) - started;
+    }
+}
+
+/**
+ * Counts arrival of barrier message from peer since the start of barrier.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param started value of counters_clock() at the start of barrier
+ */
+static inline void count_arrival(ProcessState *state, local_id from, long long started) {
+    if (state->counters) {
+        state->counters->peers[from].wait_ns += counters_clock(state) - started;
+    }
+}
+
+/**
+ * Counts passed barrier.
+ *
+ * @param state a state of current process
+ * @param started value of counters_clock() at the start of barrier
+ */
+static inline void count_barrier(ProcessState *state, long long started) {
+    if (state->counters) {
+        ++state->counters->barriers;
+        state->counters->barrier_ns += counters_clock(state) - started;
+    }
+}
+
+/**
+ * Counts time since counters were allocated until STARTED of all processes
+ * has been received for the first time. For parent allocation happens at the
+ * start of main(), so this is the startup time of whole run.
+ *
+ * @param state a state of current process
+ */
+static inline void count_startup(ProcessState *state) {
+    if (state->counters && !state->counters->startup_ns) {
+        state->counters->startup_ns = counters_clock(state) - state->counters->created_ns;
+    }
+}
+
+/**
+ * Counts completed job.
+ *
+ * @param state a state of current process
+ * @param started value of counters_clock() at the start of the first job
+ */
+static inline void count_job(ProcessState *state, long long started) {
+    if (state->counters) {
+        ++state->counters->jobs;
+        state->counters->jobs_ns = counters_clock(state) - started;
+    }
+}
+
+#endif //PA1_COUNTERS_H
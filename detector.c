@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "detector.h"
+
+int init_detector(ProcessState *state, int timeout) {
+    struct Detector *region;
+    long long now;
+    size_t size;
+    int id;
+
+    size = sizeof(struct Detector) + (size_t) (state->processes_count + 1) * sizeof(long long);
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Failed to map heartbeats: size=%zu error=%s\n", size, strerror(errno));
+        return 1;
+    }
+    region->size = size;
+    region->processes_count = state->processes_count;
+    region->timeout = timeout;
+
+    now = monotonic_ns();
+    for (id = 0; id <= state->processes_count; ++id) {
+        region->beats[id] = now;
+    }
+    state->detector = region;
+
+    return 0;
+}
+
+void cleanup_detector(ProcessState *state) {
+    if (state->detector) {
+        munmap(state->detector, state->detector->size);
+        state->detector = NULL;
+    }
+}
+
+void leave_detector(ProcessState *state) {
+    publish_exit(state, state->id);
+}
+
+void publish_exit(const ProcessState *state, local_id id) {
+    if (state->detector) {
+        __atomic_store_n(&state->detector->beats[id], HEARTBEAT_EXITED, __ATOMIC_RELEASE);
+    }
+}
+
+local_id failed_peer(ProcessState *state, const char *pending) {
+    int id;
+
+    for (id = 0; id <= state->processes_count; ++id) {
+        if (pending[id] && (state->dead[id] || peer_failed(state, (local_id) id))) {
+            return (local_id) id;
+        }
+    }
+
+    return -1;
+}
+
+int peer_failed(ProcessState *state, local_id peer) {
+    long long beat;
+
+    if (!state->detector) {
+        return 0;
+    }
+    beat = __atomic_load_n(&state->detector->beats[peer], __ATOMIC_ACQUIRE);
+    return beat == HEARTBEAT_EXITED
+           || (state->detector->timeout >= 0 && monotonic_ns() - beat > state->detector->timeout * 1000000LL);
+}
+
+int wait_slice(ProcessState *state, long long deadline) {
+    long long slice, left;
+
+    slice = -1;
+    if (detector_timeout(state) >= 0) {
+        slice = state->detector->timeout / HEARTBEAT_RATE;
+        if (slice < 1) {
+            slice = 1;
+        }
+    }
+    if (deadline >= 0) {
+        left = (deadline - monotonic_ns() + 999999) / 1000000;
+        if (left < 0) {
+            left = 0;
+        }
+        if (slice < 0 || left < slice) {
+            slice = left;
+        }
+    }
+
+    return (int) slice;
+}
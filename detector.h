@@ -0,0 +1,118 @@
+#include "core.h"
+#include "clock.h"
+
+#ifndef PA1_DETECTOR_H
+#define PA1_DETECTOR_H
+
+/*
+ * Every process publishes its heartbeat, monotonic time in nanoseconds, to
+ * shared slot of its own. Heartbeats are published while process sends
+ * messages and in every loop where it waits for channels, so only a process
+ * that has crashed or hung stays silent. Peer is dead if it has exited or its
+ * heartbeat is older than timeout. Slots are always mapped, so exit of peer
+ * is noticed without timeout too, while heartbeats are published only if
+ * timeout is set.
+ */
+
+enum {
+    HEARTBEAT_EXITED = -1, ///< Heartbeat of process that has exited
+    HEARTBEAT_RATE = 4     ///< Count of heartbeats published by waiting process per timeout
+};
+
+/**
+ * Heartbeats shared by all processes.
+ */
+struct Detector {
+    size_t    size;            ///< Size of mapped region in bytes
+    long      processes_count; ///< Total count of processes excluding parent
+    int       timeout;         ///< Time in milliseconds after which silent process is dead, negative if none
+    long long beats[];         ///< The last heartbeat by process identifier, HEARTBEAT_EXITED after exit
+};
+
+/**
+ * Maps heartbeats of all processes. Must be called by parent before fork.
+ *
+ * @param state a state of parent process
+ * @param timeout time in milliseconds after which silent process is dead, negative to track only exits
+ * @return 0 if success
+ */
+int init_detector(ProcessState *state, int timeout);
+
+/**
+ * Unmaps heartbeats. Must be called by parent after all children are
+ * joined.
+ *
+ * @param state a state of parent process
+ */
+void cleanup_detector(ProcessState *state);
+
+/**
+ * Publishes that current process has exited, so peers waiting for it fail
+ * immediately instead of waiting for timeout.
+ *
+ * @param state a state of current process
+ */
+void leave_detector(ProcessState *state);
+
+/**
+ * Publishes that process has exited on its behalf. Used for process that
+ * has never been started, so peers waiting for it fail too.
+ *
+ * @param state a state of current process
+ * @param id identifier of process that has exited
+ */
+void publish_exit(const ProcessState *state, local_id id);
+
+/**
+ * Checks whether pending peers have failed. Must be called before checking
+ * channels of peers for data: peer that exits publishes it after its last
+ * message, so a message that arrived before exit is never missed.
+ *
+ * @param state a state of current process
+ * @param pending flags indexed by process identifier, non-zero for processes to check
+ * @return identifier of the first dead peer or -1 if all of them are alive
+ */
+local_id failed_peer(ProcessState *state, const char *pending);
+
+/**
+ * Checks whether peer has exited or, if timeout is set, stayed silent for
+ * longer than timeout.
+ *
+ * @param state a state of current process
+ * @param peer process identifier
+ * @return non-zero if peer has failed
+ */
+int peer_failed(ProcessState *state, local_id peer);
+
+/**
+ * Returns time in milliseconds to block before the next heartbeat or the
+ * deadline, whatever comes first.
+ *
+ * @param state a state of current process
+ * @param deadline value of monotonic_ns() to stop waiting at, negative to wait forever
+ * @return time to block, negative to block forever
+ */
+int wait_slice(ProcessState *state, long long deadline);
+
+/**
+ * Returns timeout of failure detector.
+ *
+ * @param state a state of current process
+ * @return timeout in milliseconds, negative if only exits are tracked
+ */
+static inline int detector_timeout(ProcessState *state) {
+    return state->detector ? state->detector->timeout : -1;
+}
+
+/**
+ * Publishes heartbeat of current process if timeout is set.
+ *
+ * @param state a state of current process
+ */
+static inline void heartbeat(ProcessState *state) {
+    if (detector_timeout(state) >= 0) {
+        __atomic_store_n(&state->detector->beats[state->id], monotonic_ns(), __ATOMIC_RELEASE);
+    }
+}
+
+#endif //PA1_DETECTOR_H
@@ -3,70 +3,364 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <poll.h>
 #include "distributed.h"
+#include "pipes.h"
+#include "shm.h"
+#include "batch.h"
+#include "connections.h"
+#include "queues.h"
+#include "pool.h"
+#include "counters.h"
+#include "trace.h"
+#include "codec.h"
+#include "lamport.h"
+#include "detector.h"
 #include "pa1.h"
 
+static const char *const message_type_names[MESSAGE_TYPES_COUNT] = {
+    "STARTED", "DONE", "ACK", "STOP", "TRANSFER", "BALANCE_HISTORY", "CS_REQUEST", "CS_REPLY", "CS_RELEASE"
+};
+
+/**
+ * Writes frame of serialized header and payload to the channel between
+ * current process and destination using transport of current process.
+ * Payload is written directly from caller's buffer without copying.
+ * Header-only frames to pipes and sockets are buffered until the next
+ * frame to the same destination or until current process blocks.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param header serialized message header
+ * @param payload message payload
+ * @param payload_len length of payload
+ * @return 0 if success
+ */
+int send_frame(ProcessState *state, local_id to, const unsigned char *header,
+               const char *payload, size_t payload_len);
+
+/**
+ * Sends frame of header and payload to chosen processes as single event.
+ * Payload is sent directly from caller's buffer.
+ *
+ * @param state a state of current process
+ * @param targets flags indexed by process identifier, non-zero for processes to send to
+ * @param header a header of message
+ * @param payload message payload of header->s_payload_len bytes
+ * @return 0 if success
+ */
+int multicast_frame(ProcessState *state, const char *targets, const MessageHeader *header, const char *payload);
+
+/**
+ * Compresses payload of frame if compression is enabled and payload shrinks,
+ * replacing payload length in encoded header.
+ *
+ * @param state a state of current process
+ * @param header encoded header of frame
+ * @param payload message payload
+ * @param payload_len length of payload, replaced by length of compressed payload
+ * @param packed buffer for compressed payload of MAX_PAYLOAD_LEN bytes
+ * @return payload to send, either original or compressed
+ */
+const char *pack_payload(ProcessState *state, unsigned char *header, const char *payload, size_t *payload_len,
+                         unsigned char *packed);
+
+/**
+ * Copies payload of received frame to message, restoring it if compressed.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param header encoded header of frame
+ * @param payload payload of frame of msg->s_header.s_payload_len bytes
+ * @param msg message with decoded header, its payload length is replaced by length of restored payload
+ * @return 0 if success
+ */
+int unpack_payload(ProcessState *state, local_id from, const unsigned char *header, const unsigned char *payload,
+                   Message *msg);
+
 /**
- * Serializes message to bytes.
+ * Waits until one of pending processes has data in its channel, one of them
+ * has failed or deadline has passed. Data that arrived before failure is
+ * reported first.
  *
- * @param buffer a buffer for serialized message
- * @param message a message to serialize
+ * @param state a state of current process
+ * @param pending flags indexed by process identifier, non-zero for processes to wait for
+ * @param ready identifier of process with data in channel or failed process
+ * @param deadline value of monotonic_ns() to stop waiting at, negative to wait forever
+ * @return 0 if success, RECEIVE_TIMEOUT, RECEIVE_PEER_DEAD or positive on error
  */
-void serialize_message(unsigned char *buffer, const Message *message);
+int wait_any(ProcessState *state, const char *pending, local_id *ready, long long deadline);
 
 /**
- * Deserializes header of received message.
+ * Receives message from peer waiting until deadline. Waits for channel only
+ * if deadline is set or failure detector is enabled, otherwise reads block.
  *
- * @param buffer a buffer with serialized header
- * @param header a header that must be deserialized
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param msg message structure allocated by the caller
+ * @param deadline value of monotonic_ns() to stop waiting at, negative to wait forever
+ * @return 0 if success, RECEIVE_TIMEOUT, RECEIVE_PEER_DEAD or positive on error
  */
-void deserialize_header(const unsigned char *buffer, MessageHeader *header);
+int receive_until(ProcessState *state, local_id from, Message *msg, long long deadline);
 
 int broadcast_send(ProcessState *state, int message_type, const char *payload) {
-    Message message;
+    MessageHeader header;
+    char targets[state->processes_count + 1];
 
-    message.s_header.s_magic = MESSAGE_MAGIC;
-    message.s_header.s_type = (int16_t) message_type;
-    message.s_header.s_payload_len = (uint16_t) strlen(payload);
-    message.s_header.s_local_time = 0;
+    header.s_magic = MESSAGE_MAGIC;
+    header.s_type = (int16_t) message_type;
+    header.s_payload_len = (uint16_t) strlen(payload);
+    header.s_local_time = 0;
 
-    strcpy(message.s_payload, payload);
+    for (int id = 0; id <= state->processes_count; ++id) {
+        targets[id] = id != state->id;
+    }
 
-    return send_multicast(state, &message);
+    return multicast_frame(state, targets, &header, payload);
 }
 
 int receive_from_all(ProcessState *state, int message_type) {
     Message *message;
+    long long started;
 
-    message = malloc(sizeof(Message));
-    for (local_id id = 1; id <= state->processes_count; ++id) {
+    if (!(message = acquire_message(state, MAX_PAYLOAD_LEN))) {
+        return 1;
+    }
+    started = counters_clock(state);
+    for (int id = 1; id <= state->processes_count; ++id) {
         if (id != state->id) {
             if (receive(state, id, message)) {
                 fprintf(stderr, "(%d) Failed to receive message from: from=%d\n", state->id, id);
-                free(message);
+                release_message(state, message);
                 return 1;
             }
             if (message->s_header.s_type != message_type) {
                 fprintf(stderr, "(%d) Message has incorrect type: type=%d\n", state->id, message->s_header.s_type);
-                free(message);
+                release_message(state, message);
                 return 2;
             }
+            count_arrival(state, (local_id) id, started);
         }
     }
 
-    free(message);
+    count_barrier(state, started);
+    release_message(state, message);
     return 0;
 }
 
+int receive_from_all_any(ProcessState *state, int message_type) {
+    Message *message;
+    char pending[state->processes_count + 1];
+    long remaining;
+    long long started;
+
+    remaining = 0;
+    for (int id = 0; id <= state->processes_count; ++id) {
+        pending[id] = id != PARENT_ID && id != state->id;
+        remaining += pending[id];
+    }
+
+    if (!(message = acquire_message(state, MAX_PAYLOAD_LEN))) {
+        return 1;
+    }
+    started = counters_clock(state);
+    while (remaining > 0) {
+        if (receive_any_of(state, pending, message)) {
+            fprintf(stderr, "(%d) Failed to receive message from any process\n", state->id);
+            release_message(state, message);
+            return 1;
+        }
+        if (message->s_header.s_type != message_type) {
+            fprintf(stderr, "(%d) Message has incorrect type: type=%d\n", state->id, message->s_header.s_type);
+            release_message(state, message);
+            return 2;
+        }
+        count_arrival(state, state->last_from, started);
+        pending[state->last_from] = 0;
+        --remaining;
+    }
+
+    count_barrier(state, started);
+    release_message(state, message);
+    return 0;
+}
+
+int receive_any(void *self, Message *msg) {
+    ProcessState *state = (ProcessState *) self;
+    char pending[state->processes_count + 1];
+
+    for (int id = 0; id <= state->processes_count; ++id) {
+        pending[id] = id != state->id;
+    }
+
+    return receive_any_of(state, pending, msg);
+}
+
+int receive_any_of(ProcessState *state, const char *pending, Message *msg) {
+    return receive_any_within(state, pending, msg, -1);
+}
+
+int receive_any_within(ProcessState *state, const char *pending, Message *msg, int timeout) {
+    long long deadline;
+    local_id from;
+    int result;
+
+    deadline = timeout >= 0 ? monotonic_ns() + timeout * 1000000LL : -1;
+    if ((result = wait_any(state, pending, &from, deadline))) {
+        state->last_from = from;
+        return result < 0 ? result : 1;
+    }
+    if ((result = receive_until(state, from, msg, deadline))) {
+        return result < 0 ? result : 2;
+    }
+    state->last_from = from;
+
+    return 0;
+}
+
+int receive_within(ProcessState *state, local_id from, Message *msg, int timeout) {
+    return receive_until(state, from, msg, timeout >= 0 ? monotonic_ns() + timeout * 1000000LL : -1);
+}
+
+int wait_any(ProcessState *state, const char *pending, local_id *ready, long long deadline) {
+    struct pollfd fds[state->processes_count + 1];
+    local_id ids[state->processes_count + 1];
+    nfds_t count;
+    long total, i;
+    long long started;
+    local_id failed;
+    int slice;
+
+    total = state->processes_count + 1;
+    *ready = -1;
+
+    for (;;) {
+        heartbeat(state);
+        failed = failed_peer(state, pending);
+        slice = failed >= 0 ? 0 : wait_slice(state, deadline);
+
+        if (state->transport == TRANSPORT_SHM || state->transport == TRANSPORT_QUEUES) {
+            started = counters_clock(state);
+            *ready = shm_wait_any(state, pending, slice);
+            count_blocked(state, started);
+            if (*ready >= 0) {
+                return 0;
+            }
+        } else {
+            for (i = 1; i <= total; ++i) {
+                local_id id = (local_id) ((state->last_from + i) % total);
+
+                if (pending[id] && state->inputs[id].checked > state->inputs[id].start) {
+                    *ready = id;
+                    return 0;
+                }
+            }
+            if (flush_batches(state)) {
+                return 1;
+            }
+
+            count = 0;
+            for (i = 1; i <= total; ++i) {
+                local_id id = (local_id) ((state->last_from + i) % total);
+
+                if (pending[id]) {
+                    if (state->reading_pipes[id] < 0) {
+                        if (request_connection(state, id)) {
+                            return 1;
+                        }
+                        continue;
+                    }
+                    fds[count].fd = state->reading_pipes[id];
+                    fds[count].events = POLLIN;
+                    fds[count].revents = 0;
+                    ids[count++] = id;
+                }
+            }
+            started = counters_clock(state);
+            if (state->transport == TRANSPORT_SOCKETS) {
+                int result;
+
+                result = poll_connections(state, fds, count, slice);
+                count_blocked(state, started);
+                if (result < 0) {
+                    return 1;
+                }
+                if (result == 1) {
+                    continue;
+                }
+            } else {
+                if (!count) {
+                    fprintf(stderr, "(%d) Nothing to wait for\n", state->id);
+                    return 1;
+                }
+                count_poll(state);
+                while (poll(fds, count, slice) < 0) {
+                    if (errno != EINTR) {
+                        fprintf(stderr, "(%d) Failed to poll pipes: error=%s\n", state->id, strerror(errno));
+                        return 1;
+                    }
+                }
+                count_blocked(state, started);
+            }
+
+            for (i = 0; i < (long) count; ++i) {
+                if (fds[i].revents & POLLIN) {
+                    *ready = ids[i];
+                    return 0;
+                }
+            }
+            for (i = 0; i < (long) count; ++i) {
+                if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                    fprintf(stderr, "(%d) Pipe was closed by process: from=%d descriptor=%d\n",
+                            state->id, ids[i], fds[i].fd);
+                    state->dead[ids[i]] = 1;
+                    *ready = ids[i];
+                    return RECEIVE_PEER_DEAD;
+                }
+            }
+        }
+
+        if (failed >= 0) {
+            if (!state->dead[failed]) {
+                fprintf(stderr, "(%d) Peer is dead: peer=%d\n", state->id, failed);
+                state->dead[failed] = 1;
+            }
+            *ready = failed;
+            return RECEIVE_PEER_DEAD;
+        }
+        if (deadline >= 0 && monotonic_ns() >= deadline) {
+            return RECEIVE_TIMEOUT;
+        }
+    }
+}
+
 int send_multicast(void *self, const Message *msg) {
-    ProcessState *state;
-    local_id id;
+    ProcessState *state = (ProcessState *) self;
+    char targets[state->processes_count + 1];
+
+    for (int id = 0; id <= state->processes_count; ++id) {
+        targets[id] = id != state->id;
+    }
+
+    return send_multicast_to(state, targets, msg);
+}
+
+int send_multicast_to(ProcessState *state, const char *targets, const Message *message) {
+    return multicast_frame(state, targets, &message->s_header, message->s_payload);
+}
 
-    state = (ProcessState *) self;
+int multicast_frame(ProcessState *state, const char *targets, const MessageHeader *header, const char *payload) {
+    int id;
+    unsigned char buffer[sizeof(MessageHeader)];
+    unsigned char packed[MAX_PAYLOAD_LEN];
+    size_t payload_len;
 
+    encode_header(buffer, header, lamport_tick(state));
+    payload_len = header->s_payload_len;
+    payload = pack_payload(state, buffer, payload, &payload_len, packed);
     for (id = 0; id <= state->processes_count; ++id) {
-        if (id != state->id) {
-            if (send(state, id, msg)) {
+        if (targets[id]) {
+            if (send_frame(state, id, buffer, payload, payload_len)) {
                 fprintf(stderr, "(%d) Failed to write multicast message: to=%d\n", state->id, id);
                 return 1;
             }
@@ -77,87 +371,195 @@ int send_multicast(void *self, const Message *msg) {
 }
 
 int send(void *self, local_id to, const Message *message) {
-    size_t serialized_size;
-    unsigned char buffer[MAX_PAYLOAD_LEN];
-    ProcessState *state;
+    return send_payload((ProcessState *) self, to, &message->s_header, message->s_payload);
+}
 
-    state = (ProcessState *) self;
+int send_payload(ProcessState *state, local_id to, const MessageHeader *header, const char *payload) {
+    unsigned char buffer[sizeof(MessageHeader)];
+    unsigned char packed[MAX_PAYLOAD_LEN];
+    size_t payload_len;
 
-    serialize_message(buffer, message);
-    serialized_size = sizeof(MessageHeader) + message->s_header.s_payload_len;
+    encode_header(buffer, header, lamport_tick(state));
+    payload_len = header->s_payload_len;
+    payload = pack_payload(state, buffer, payload, &payload_len, packed);
+    return send_frame(state, to, buffer, payload, payload_len);
+}
 
-    if (serialized_size != write(state->writing_pipes[to], buffer, serialized_size)) {
-        fprintf(stderr, "(%d) Failed to send message to=%d (descriptor=%d) error=%s\n",
-                state->id, to, state->writing_pipes[to], strerror(errno));
-        return 1;
-    }
+const char *pack_payload(ProcessState *state, unsigned char *header, const char *payload, size_t *payload_len,
+                         unsigned char *packed) {
+    size_t packed_len;
 
-    return 0;
+    if (!state->compress || !(packed_len = compress_payload(payload, *payload_len, packed))) {
+        return payload;
+    }
+    mark_compressed(header, packed_len);
+    *payload_len = packed_len;
+    return (const char *) packed;
 }
 
-void serialize_message(unsigned char *buffer, const Message *message) {
-    buffer[0] = (unsigned char) message->s_header.s_magic >> 8;
-    buffer[1] = (unsigned char) message->s_header.s_magic;
+int unpack_payload(ProcessState *state, local_id from, const unsigned char *header, const unsigned char *payload,
+                   Message *msg) {
+    uint16_t payload_len;
 
-    buffer[2] = (unsigned char) message->s_header.s_type >> 8;
-    buffer[3] = (unsigned char) message->s_header.s_type;
+    if (!header_compressed(header)) {
+        memcpy(msg->s_payload, payload, msg->s_header.s_payload_len);
+        return 0;
+    }
+    if (decompress_payload(payload, msg->s_header.s_payload_len, msg->s_payload, &payload_len)) {
+        fprintf(stderr, "(%d) Invalid compressed payload: from=%d length=%d\n",
+                state->id, from, msg->s_header.s_payload_len);
+        return 1;
+    }
+    msg->s_header.s_payload_len = payload_len;
+    return 0;
+}
 
-    buffer[4] = (unsigned char) message->s_header.s_payload_len >> 8;
-    buffer[5] = (unsigned char) message->s_header.s_payload_len;
+int send_frame(ProcessState *state, local_id to, const unsigned char *header,
+               const char *payload, size_t payload_len) {
+    count_sent(state, to, encoded_type(header), payload_len);
+    heartbeat(state);
+    trace_event(state, TRACE_SEND, to, encoded_type(header), NULL);
+    if (state->transport == TRANSPORT_QUEUES) {
+        return enqueue_frame(state, to, header, payload, payload_len);
+    }
+    if (state->transport == TRANSPORT_SHM) {
+        if (shm_write(state, to, header, sizeof(MessageHeader))) {
+            return 1;
+        }
+        return payload_len ? shm_write(state, to, payload, payload_len) : 0;
+    }
 
-    buffer[6] = (unsigned char) message->s_header.s_local_time >> 8;
-    buffer[7] = (unsigned char) message->s_header.s_local_time;
+    if (state->transport == TRANSPORT_SOCKETS && connect_peer(state, to)) {
+        return 1;
+    }
+    if (state->batch_limit) {
+        return batch_frame(state, to, header, payload, payload_len);
+    }
+    if (!payload_len && state->coalesce) {
+        return batch_control(state, to, header);
+    }
 
-    memcpy(&buffer[8], message->s_payload, message->s_header.s_payload_len);
+    return write_frame(state, to, header, payload, payload_len);
 }
 
 int receive(void *self, local_id from, Message *msg) {
-    ProcessState *state;
-    unsigned char buffer[MAX_MESSAGE_LEN];
-    ssize_t bytes_read;
-
-    state = (ProcessState *) self;
-    while ((bytes_read = read(state->reading_pipes[from], buffer, sizeof(MessageHeader))) <= 0) {
-        if (bytes_read < 0) {
-            fprintf(stderr, "(%d) Failed to read from pipe: descriptor=%d error=%s\n",
-                    state->id, state->reading_pipes[from], strerror(errno));
-            return 1;
+    return receive_until((ProcessState *) self, from, msg, -1);
+}
+
+int receive_until(ProcessState *state, local_id from, Message *msg, long long deadline) {
+    unsigned char buffer[sizeof(MessageHeader)];
+    char pending[state->processes_count + 1];
+    InputBuffer *input;
+    const unsigned char *frame;
+    local_id ready;
+    int waits, result;
+
+    waits = deadline >= 0 || detector_timeout(state) >= 0 || state->dead[from];
+    if (waits) {
+        memset(pending, 0, sizeof(pending));
+        pending[from] = 1;
+    }
+
+    if (state->transport == TRANSPORT_QUEUES || state->transport == TRANSPORT_SHM) {
+        if (waits && (result = wait_any(state, pending, &ready, deadline))) {
+            return result;
+        }
+    }
+    if (state->transport == TRANSPORT_QUEUES) {
+        if (!(frame = dequeue_frame(state, from))) {
+            return state->dead[from] ? RECEIVE_PEER_DEAD : 1;
+        }
+        if (decode_header(frame, &msg->s_header)) {
+            fprintf(stderr, "(%d) Invalid message header: from=%d\n", state->id, from);
+            release_frame(state, frame);
+            return 2;
+        }
+        count_received(state, from, &msg->s_header);
+        if (unpack_payload(state, from, frame, frame + sizeof(MessageHeader), msg)) {
+            release_frame(state, frame);
+            return 3;
         }
+        release_frame(state, frame);
+        lamport_receive(state, msg->s_header.s_local_time);
+        trace_event(state, TRACE_RECEIVE, from, msg->s_header.s_type, NULL);
+        return 0;
     }
+    if (state->transport == TRANSPORT_SHM) {
+        if (shm_read(state, from, buffer, sizeof(MessageHeader))) {
+            return state->dead[from] ? RECEIVE_PEER_DEAD : 1;
+        }
+        if (decode_header(buffer, &msg->s_header)) {
+            fprintf(stderr, "(%d) Invalid message header: from=%d\n", state->id, from);
+            return 2;
+        }
+        count_received(state, from, &msg->s_header);
+        if (header_compressed(buffer)) {
+            unsigned char packed[MAX_PAYLOAD_LEN];
 
-    deserialize_header(buffer, &msg->s_header);
+            if (shm_read(state, from, packed, msg->s_header.s_payload_len)
+                || unpack_payload(state, from, buffer, packed, msg)) {
+                return 3;
+            }
+        } else if (msg->s_header.s_payload_len
+                   && shm_read(state, from, msg->s_payload, msg->s_header.s_payload_len)) {
+            return 3;
+        }
+        lamport_receive(state, msg->s_header.s_local_time);
+        trace_event(state, TRACE_RECEIVE, from, msg->s_header.s_type, NULL);
+        return 0;
+    }
 
-    while ((bytes_read = read(state->reading_pipes[from], msg->s_payload, msg->s_header.s_payload_len)) <= 0) {
-        if (bytes_read < 0) {
-            fprintf(stderr, "(%d) Failed to read from pipe: descriptor=%d error=%s\n",
-                    state->id, state->reading_pipes[from], strerror(errno));
-            return 2;
+    input = &state->inputs[from];
+    while (!(frame = next_frame(input))) {
+        if (waits && (result = wait_any(state, pending, &ready, deadline))) {
+            return result;
+        }
+        if ((result = fill_input(state, from))) {
+            if (result == FILL_CLOSED) {
+                state->dead[from] = 1;
+                return RECEIVE_PEER_DEAD;
+            }
+            return 1;
         }
     }
 
+    decode_header(frame, &msg->s_header);
+    input->start += sizeof(MessageHeader) + msg->s_header.s_payload_len;
+    count_received(state, from, &msg->s_header);
+    if (unpack_payload(state, from, frame, frame + sizeof(MessageHeader), msg)) {
+        return 2;
+    }
+    if (input->start == input->end) {
+        input->start = input->checked = input->end = 0;
+    }
+    lamport_receive(state, msg->s_header.s_local_time);
+    trace_event(state, TRACE_RECEIVE, from, msg->s_header.s_type, NULL);
+
     return 0;
 }
 
-void deserialize_header(const unsigned char *buffer, MessageHeader *header) {
-    uint16_t magic;
-    uint16_t payload_len;
-    int16_t type;
-    timestamp_t local_time;
-
-    magic = buffer[0] << 8;
-    magic |= buffer[1];
-
-    type = buffer[2] << 8;
-    type |= buffer[3];
+int flush(ProcessState *state) {
+    return flush_batches(state);
+}
 
-    payload_len = buffer[4] << 8;
-    payload_len |= buffer[5];
+const char *message_type_name(int type) {
+    return type >= 0 && type < MESSAGE_TYPES_COUNT ? message_type_names[type] : "UNKNOWN";
+}
 
-    local_time = buffer[6] << 8;
-    local_time |= buffer[7];
+void cleanup_channels(ProcessState *state) {
+    if (state->transport == TRANSPORT_QUEUES) {
+        return;
+    }
+    if (state->transport == TRANSPORT_SHM) {
+        cleanup_shm(state);
+        return;
+    }
 
-    header->s_magic = magic;
-    header->s_payload_len = payload_len;
-    header->s_type = type;
-    header->s_local_time = local_time;
+    flush_batches(state);
+    release_buffers(state);
+    if (state->transport == TRANSPORT_SOCKETS) {
+        cleanup_connections(state);
+    } else {
+        cleanup_pipes(state);
+    }
 }
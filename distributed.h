@@ -4,6 +4,11 @@
 #include "ipc.h"
 #include "core.h"
 
+enum {
+    RECEIVE_TIMEOUT = -1,  ///< Deadline has passed before message arrived
+    RECEIVE_PEER_DEAD = -2 ///< Peer has exited or was detected as dead before message arrived
+};
+
 /**
  * Broadcasts message to all other processes.
  *
@@ -23,4 +28,124 @@ int broadcast_send(ProcessState *state, int message_type, const char *payload);
  */
 int receive_from_all(ProcessState *state, int message_type);
 
+/**
+ * Receives message from all other processes in order of arrival, so slow
+ * process doesn't delay messages already sent by others.
+ *
+ * @param state a state of current process
+ * @param message_type message type to receive
+ * @return 0 if success
+ */
+int receive_from_all_any(ProcessState *state, int message_type);
+
+/**
+ * Receives message from any of pending processes. Sender of received message
+ * is stored to state->last_from.
+ *
+ * @param state a state of current process
+ * @param pending flags indexed by process identifier, non-zero for processes to receive from
+ * @param msg message structure allocated by the caller
+ * @return 0 if success
+ */
+int receive_any_of(ProcessState *state, const char *pending, Message *msg);
+
+/**
+ * Receives message from peer, but waits not longer than timeout. Unlike
+ * receive() with failure detector disabled, returns if peer has exited or
+ * closed its channel. Blocked process publishes its heartbeat and checks
+ * peer every 1 / HEARTBEAT_RATE of detector timeout.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param msg message structure allocated by the caller
+ * @param timeout time to wait in milliseconds, negative to wait while peer is alive
+ * @return 0 if success, RECEIVE_TIMEOUT, RECEIVE_PEER_DEAD or positive on error
+ */
+int receive_within(ProcessState *state, local_id from, Message *msg, int timeout);
+
+/**
+ * Receives message from any of pending processes, but waits not longer than
+ * timeout. Returns as soon as one of pending processes has failed, because
+ * callers wait for all of them anyway. Sender of received message or failed
+ * process is stored to state->last_from.
+ *
+ * @param state a state of current process
+ * @param pending flags indexed by process identifier, non-zero for processes to receive from
+ * @param msg message structure allocated by the caller
+ * @param timeout time to wait in milliseconds, negative to wait while peers are alive
+ * @return 0 if success, RECEIVE_TIMEOUT, RECEIVE_PEER_DEAD or positive on error
+ */
+int receive_any_within(ProcessState *state, const char *pending, Message *msg, int timeout);
+
+/**
+ * Sends message to chosen processes as single event: header is serialized and
+ * stamped with Lamport time once, so all receivers get the same time.
+ *
+ * @param state a state of current process
+ * @param targets flags indexed by process identifier, non-zero for processes to send to
+ * @param message a message to send
+ * @return 0 if success
+ */
+int send_multicast_to(ProcessState *state, const char *targets, const Message *message);
+
+/**
+ * Sends message whose payload is taken from memory of the caller, so large
+ * data is written to channel without copying it to Message first.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param header header of message, its time is ignored
+ * @param payload payload of header->s_payload_len bytes
+ * @return 0 if success
+ */
+int send_payload(ProcessState *state, local_id to, const MessageHeader *header, const char *payload);
+
+/**
+ * Synchronizes all processes including parent with dissemination barrier.
+ * In round k process sends message to process (id + 2^k) and receives
+ * message of the same type from process (id - 2^k), so barrier takes
+ * ceil(log2(N + 1)) rounds and O(N log N) messages instead of O(N^2).
+ *
+ * @param state a state of current process
+ * @param message a message to send in every round
+ * @return 0 if success
+ */
+int barrier(ProcessState *state, const Message *message);
+
+/**
+ * Broadcasts message from root to all processes including parent along
+ * binomial tree, so every process sends at most ceil(log2(N + 1)) messages.
+ *
+ * @param state a state of current process
+ * @param root identifier of process that broadcasts message
+ * @param message a message to broadcast on root, received message on others
+ * @return 0 if success
+ */
+int tree_broadcast(ProcessState *state, local_id root, Message *message);
+
+/**
+ * Writes all batched messages of current process. Must be called when
+ * batching is enabled and process is going to wait without receiving.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int flush(ProcessState *state);
+
+/**
+ * Returns name of message type for logs and traces.
+ *
+ * @param type type of message
+ * @return name of type, "UNKNOWN" for types not defined in ipc.h
+ */
+const char *message_type_name(int type);
+
+/**
+ * Releases channels of current process created by its transport. Queues
+ * between threads are shared, so they are released by parent after join.
+ *
+ * @param state a state of current process
+ */
+void cleanup_channels(ProcessState *state);
+
 #endif //PA1_DISTRIBUTED_H
@@ -1,53 +1,250 @@
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "core.h"
 #include "pa1.h"
 #include "distributed.h"
+#include "phases.h"
+#include "mutex.h"
+#include "bank.h"
+#include "pool.h"
+#include "counters.h"
+
+static const char * const log_loop_operation_fmt =
+    "process %1d is doing %d iteration out of %d\n";
+
+/**
+ * Indexes of phases in tables.
+ */
+enum {
+    CHILD_ANNOUNCE_STARTED = 0,
+    CHILD_COLLECT_STARTED,
+    CHILD_WORK,
+    CHILD_ANNOUNCE_DONE,
+    CHILD_COLLECT_DONE,
+    CHILD_SEND_HISTORY,
+
+    PARENT_COLLECT_STARTED = 0,
+    PARENT_WORK,
+    PARENT_COLLECT_DONE,
+    PARENT_RECEIVE_HISTORIES
+};
 
 int broadcast_started(ProcessState *state);
 int broadcast_done(ProcessState *state);
 int receive_started_from_all(ProcessState *state);
 int receive_done_from_all(ProcessState *state);
 
-int child_phase_1(ProcessState *state) {
-    if (broadcast_started(state)) {
-        return 1;
-    }
-    if (receive_started_from_all(state)) {
-        return 2;
+/**
+ * Receives STARTED from all processes, or passes dissemination barrier that
+ * also sends STARTED of current process.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int collect_started(ProcessState *state);
+
+/**
+ * Receives DONE from all processes, or passes dissemination barrier that
+ * also sends DONE of current process.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int collect_done(ProcessState *state);
+
+/**
+ * Implements work of child process: serving transfers or entering critical
+ * section in loop.
+ *
+ * @param state a state of current child process
+ * @return 0 if success
+ */
+int child_work(ProcessState *state);
+
+/**
+ * Implements work of parent process: transfers between accounts.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int parent_work(ProcessState *state);
+
+/**
+ * Enters critical section (id * 5) times and logs every iteration inside it.
+ *
+ * @param state a state of current child process
+ * @return 0 if success
+ */
+int loop_critical_section(ProcessState *state);
+
+/**
+ * Checks whether STARTED is sent separately from receiving, i.e. dissemination
+ * barrier isn't used.
+ *
+ * @param state a state of current process
+ * @return non-zero if STARTED is announced by separate phase
+ */
+int announces_started(ProcessState *state);
+
+/**
+ * Checks whether DONE is sent separately from receiving, i.e. dissemination
+ * barrier isn't used.
+ *
+ * @param state a state of current process
+ * @return non-zero if DONE is announced by separate phase
+ */
+int announces_done(ProcessState *state);
+
+/**
+ * Checks whether DONE may be synchronized with dissemination barrier. It may
+ * not when children serve critical section or transfers while waiting for
+ * DONE, because barrier receives only messages of its own type.
+ *
+ * @param state a state of current process
+ * @return non-zero if dissemination barrier may be used
+ */
+int disseminate_done(ProcessState *state);
+
+/**
+ * Checks whether process has work in the second phase.
+ *
+ * @param state a state of current process
+ * @return non-zero if process has work
+ */
+int has_work(ProcessState *state);
+
+/**
+ * Checks whether bank is enabled.
+ *
+ * @param state a state of current process
+ * @return non-zero if bank is enabled
+ */
+int has_bank(ProcessState *state);
+
+/**
+ * Synchronizes all processes including parent with dissemination barrier.
+ *
+ * @param state a state of current process
+ * @param message_type type of barrier messages
+ * @param payload payload of barrier messages, logged as event by children
+ * @param received_fmt format of event logged after barrier
+ * @return 0 if success
+ */
+int synchronize(ProcessState *state, int message_type, const char *payload, const char *received_fmt);
+
+const Phase child_phases[CHILD_PHASES_COUNT] = {
+    {"announce started", broadcast_started, announces_started, 0, 0},
+    {"collect started", collect_started, NULL, 1u << CHILD_ANNOUNCE_STARTED, 1},
+    {"work", child_work, has_work, 1u << CHILD_COLLECT_STARTED, 1},
+    {"announce done", broadcast_done, announces_done,
+     1u << CHILD_ANNOUNCE_STARTED | 1u << CHILD_COLLECT_STARTED | 1u << CHILD_WORK, 0},
+    {"collect done", collect_done, NULL,
+     1u << CHILD_COLLECT_STARTED | 1u << CHILD_WORK | 1u << CHILD_ANNOUNCE_DONE, 1},
+    {"send history", send_history, has_bank, 1u << CHILD_COLLECT_DONE, 0}
+};
+
+const Phase parent_phases[PARENT_PHASES_COUNT] = {
+    {"collect started", collect_started, NULL, 0, 1},
+    {"work", parent_work, has_bank, 1u << PARENT_COLLECT_STARTED, 1},
+    {"collect done", collect_done, NULL, 1u << PARENT_COLLECT_STARTED | 1u << PARENT_WORK, 1},
+    {"receive histories", receive_histories, has_bank, 1u << PARENT_COLLECT_DONE, 1}
+};
+
+int run_child_jobs(ProcessState *state) {
+    Message message;
+    int result;
+
+    for (;;) {
+        memset(state->done_received, 0, (size_t) state->processes_count + 1);
+        if ((result = run_phases(state, child_phases, CHILD_PHASES_COUNT)) || state->jobs <= 1) {
+            return result;
+        }
+
+        if (receive(state, PARENT_ID, &message)) {
+            fprintf(stderr, "(%d) Failed to receive next job\n", state->id);
+            return CHILD_PHASES_COUNT + 1;
+        }
+        if (message.s_header.s_type == STOP) {
+            return 0;
+        }
+        if (message.s_header.s_type != STARTED) {
+            fprintf(stderr, "(%d) Message has incorrect type: type=%d\n", state->id, message.s_header.s_type);
+            return CHILD_PHASES_COUNT + 2;
+        }
     }
-    return 0;
 }
 
-int child_phase_2(ProcessState *state) {
+int run_parent_jobs(ProcessState *state) {
+    long long started;
+    long job;
+    int result;
+
+    started = counters_clock(state);
+    for (job = 1; job <= state->jobs; ++job) {
+        if (job > 1 && broadcast_send(state, STARTED, "")) {
+            return PARENT_PHASES_COUNT + 1;
+        }
+        memset(state->done_received, 0, (size_t) state->processes_count + 1);
+        if ((result = run_phases(state, parent_phases, PARENT_PHASES_COUNT))) {
+            return result;
+        }
+        count_job(state, started);
+    }
+
+    if (state->jobs > 1 && broadcast_send(state, STOP, "")) {
+        return PARENT_PHASES_COUNT + 2;
+    }
     return 0;
 }
 
-int child_phase_3(ProcessState *state) {
-    if (broadcast_done(state)) {
-        return 1;
+int collect_started(ProcessState *state) {
+    int result;
+
+    if (state->barrier_kind == BARRIER_DISSEMINATION) {
+        char buffer[MAX_PAYLOAD_LEN];
+
+        buffer[0] = '\0';
+        if (state->id != PARENT_ID) {
+            sprintf(buffer, log_started_fmt, state->id, getpid(), getppid());
+        }
+        result = synchronize(state, STARTED, buffer, log_received_all_started_fmt);
+    } else {
+        result = receive_started_from_all(state);
     }
-    if (receive_done_from_all(state)) {
-        return 2;
+    if (!result && state->id == PARENT_ID) {
+        count_startup(state);
     }
-    return 0;
+    return result;
 }
 
-int parent_phase_1(ProcessState *state) {
-    if (receive_started_from_all(state)) {
-        return 1;
+int collect_done(ProcessState *state) {
+    if (disseminate_done(state)) {
+        char buffer[MAX_PAYLOAD_LEN];
+
+        buffer[0] = '\0';
+        if (state->id != PARENT_ID) {
+            sprintf(buffer, log_done_fmt, state->id);
+        }
+        return synchronize(state, DONE, buffer, log_received_all_done_fmt);
     }
-    return 0;
+    return receive_done_from_all(state);
 }
 
-int parent_phase_2(ProcessState *state) {
-    return 0;
+int child_work(ProcessState *state) {
+    if (state->bank) {
+        return serve_transfers(state);
+    }
+    return loop_critical_section(state);
 }
 
-int parent_phase_3(ProcessState *state) {
-    if (receive_done_from_all(state)) {
+int parent_work(ProcessState *state) {
+    if (bank_robbery(state, (local_id) state->processes_count)) {
         return 1;
     }
+    if (broadcast_send(state, STOP, "")) {
+        return 2;
+    }
     return 0;
 }
 
@@ -76,7 +273,7 @@ int broadcast_done(ProcessState *state) {
 int receive_started_from_all(ProcessState *state) {
     char buffer[MAX_PAYLOAD_LEN];
 
-    if (receive_from_all(state, STARTED)) {
+    if (receive_from_all_any(state, STARTED)) {
         return 1;
     }
     sprintf(buffer, log_received_all_started_fmt, state->id);
@@ -87,7 +284,7 @@ int receive_started_from_all(ProcessState *state) {
 int receive_done_from_all(ProcessState *state) {
     char buffer[MAX_PAYLOAD_LEN];
 
-    if (receive_from_all(state, DONE)) {
+    if (receive_done_serving_cs(state)) {
         return 1;
     }
     sprintf(buffer, log_received_all_done_fmt, state->id);
@@ -95,3 +292,68 @@ int receive_done_from_all(ProcessState *state) {
     return 0;
 }
 
+int announces_started(ProcessState *state) {
+    return state->barrier_kind != BARRIER_DISSEMINATION;
+}
+
+int announces_done(ProcessState *state) {
+    return !disseminate_done(state);
+}
+
+int disseminate_done(ProcessState *state) {
+    return state->barrier_kind == BARRIER_DISSEMINATION && !state->mutexl && !state->bank;
+}
+
+int has_work(ProcessState *state) {
+    return state->bank || state->mutexl;
+}
+
+int has_bank(ProcessState *state) {
+    return state->bank != NULL;
+}
+
+int synchronize(ProcessState *state, int message_type, const char *payload, const char *received_fmt) {
+    Message *message;
+    char buffer[MAX_PAYLOAD_LEN];
+    size_t payload_len;
+
+    payload_len = strlen(payload);
+    if (!(message = acquire_message(state, payload_len))) {
+        return 1;
+    }
+    message->s_header.s_magic = MESSAGE_MAGIC;
+    message->s_header.s_type = (int16_t) message_type;
+    message->s_header.s_payload_len = (uint16_t) payload_len;
+    message->s_header.s_local_time = 0;
+    memcpy(message->s_payload, payload, payload_len);
+
+    if (state->id != PARENT_ID) {
+        log_event(state, payload);
+    }
+    if (barrier(state, message)) {
+        release_message(state, message);
+        return 2;
+    }
+    release_message(state, message);
+    sprintf(buffer, received_fmt, state->id);
+    log_event(state, buffer);
+    return 0;
+}
+
+int loop_critical_section(ProcessState *state) {
+    char buffer[MAX_PAYLOAD_LEN];
+    int i, count;
+
+    count = state->id * 5;
+    for (i = 1; i <= count; ++i) {
+        if (request_cs(state)) {
+            return 1;
+        }
+        sprintf(buffer, log_loop_operation_fmt, state->id, i, count);
+        log_event(state, buffer);
+        if (release_cs(state)) {
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include "core.h"
+
+#ifndef PA1_LAMPORT_H
+#define PA1_LAMPORT_H
+
+/**
+ * Advances Lamport time of current process before local event or sending.
+ *
+ * @param state a state of current process
+ * @return new Lamport time
+ */
+static inline timestamp_t lamport_tick(ProcessState *state) {
+    return ++state->local_time;
+}
+
+/**
+ * Merges time of received message into Lamport time of current process.
+ *
+ * @param state a state of current process
+ * @param time Lamport time of sender when message was sent
+ * @return new Lamport time
+ */
+static inline timestamp_t lamport_receive(ProcessState *state, timestamp_t time) {
+    if (time > state->local_time) {
+        state->local_time = time;
+    }
+    return ++state->local_time;
+}
+
+#endif //PA1_LAMPORT_H
@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "shm.h"
+
+/**
+ * Kind of log record.
+ */
+enum {
+    LOG_RECORD_EVENT = 0, ///< Record for events log
+    LOG_RECORD_PIPE,      ///< Record for pipes events log
+    LOG_RECORD_CLOSE      ///< Parent has finished, logger process must exit after draining rings
+};
+
+/**
+ * Header of region with rings drained by logger process. Rings are placed
+ * right after header, one per producer process.
+ */
+struct LogRegion {
+    size_t size;      ///< Size of mapped region in bytes
+    long   producers; ///< Count of child processes, parent is producer too
+};
+
+/**
+ * Writes log record in chosen way.
+ *
+ * @param state a state of current process
+ * @param kind kind of record
+ * @param text text of record
+ * @param length length of text
+ */
+void write_record(ProcessState *state, unsigned char kind, const char *text, size_t length);
+
+/**
+ * Writes record to log files immediately.
+ *
+ * @param logger log with files
+ * @param kind kind of record
+ * @param text text of record
+ * @param length length of text
+ */
+void write_direct(Logger *logger, unsigned char kind, const char *text, size_t length);
+
+/**
+ * Appends record to buffer of log, flushing buffer if it's full.
+ *
+ * @param logger log with buffers
+ * @param kind kind of record
+ * @param text text of record
+ * @param length length of text
+ */
+void append_record(Logger *logger, unsigned char kind, const char *text, size_t length);
+
+/**
+ * Writes buffered records of log to log files.
+ *
+ * @param logger log with buffers
+ */
+void flush_buffers(Logger *logger);
+
+/**
+ * Writes all bytes to file, retrying partial writes.
+ *
+ * @param descriptor file descriptor
+ * @param data bytes to write
+ * @param size count of bytes to write
+ */
+void write_all(int descriptor, const char *data, size_t size);
+
+/**
+ * Returns ring of producer process.
+ *
+ * @param region region with rings
+ * @param producer identifier of producer process
+ * @return ring
+ */
+ShmRing *log_ring(struct LogRegion *region, local_id producer);
+
+/**
+ * Main loop of logger process: drains rings of all processes until parent
+ * closes its log or exits.
+ *
+ * @param logger buffered log writing to log files
+ * @param parent process identifier of parent
+ * @return 0 if success
+ */
+int drain_logs(Logger *logger, pid_t parent);
+
+void init_log(Logger *logger, const Options *options, int evt_log, int pd_log) {
+    memset(logger, 0, sizeof(Logger));
+    logger->mode = options->log_mode;
+    logger->level = options->log_level;
+    logger->evt_log = evt_log;
+    logger->pd_log = pd_log;
+    logger->region = NULL;
+    logger->events = logger->pipes = NULL;
+}
+
+int start_logger(ProcessState *state) {
+    Logger *logger;
+    struct LogRegion *region;
+    size_t size;
+    long id;
+    pid_t parent, pid;
+
+    logger = &state->logger;
+    if (logger->mode != LOG_ASYNC) {
+        return 0;
+    }
+
+    size = CACHE_LINE_SIZE + (size_t) (state->processes_count + 1) * (sizeof(ShmRing) + SHM_RING_CAPACITY);
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Failed to map log rings: size=%zu error=%s\n", size, strerror(errno));
+        return 1;
+    }
+    region->size = size;
+    region->producers = state->processes_count;
+    for (id = 0; id <= region->producers; ++id) {
+        log_ring(region, (local_id) id)->capacity = SHM_RING_CAPACITY;
+    }
+    logger->region = region;
+
+    parent = getpid();
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork logger process: error=%s\n", strerror(errno));
+        munmap(region, size);
+        logger->region = NULL;
+        return 1;
+    } else if (!pid) {
+        Logger output;
+
+        output = *logger;
+        output.mode = LOG_BUFFERED;
+        _exit(drain_logs(&output, parent));
+    }
+    logger->logger_pid = pid;
+
+    return 0;
+}
+
+void flush_log(ProcessState *state) {
+    if (state->logger.mode == LOG_BUFFERED) {
+        flush_buffers(&state->logger);
+    }
+}
+
+void close_log(ProcessState *state) {
+    Logger *logger;
+
+    logger = &state->logger;
+    flush_log(state);
+    free(logger->events);
+    free(logger->pipes);
+    logger->events = logger->pipes = NULL;
+
+    if (logger->region) {
+        if (state->id == PARENT_ID && logger->logger_pid > 0) {
+            write_record(state, LOG_RECORD_CLOSE, "", 0);
+            waitpid(logger->logger_pid, NULL, 0);
+            logger->logger_pid = 0;
+        }
+        munmap(logger->region, logger->region->size);
+        logger->region = NULL;
+    }
+}
+
+void log_pipe(ProcessState *state, const char *fmt, ...) {
+    va_list args;
+    char buffer[LOG_RECORD_LIMIT];
+    int length;
+
+    if (state->logger.level < LOG_LEVEL_PIPES) {
+        return;
+    }
+
+    va_start(args, fmt);
+    length = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if (length > 0) {
+        write_record(state, LOG_RECORD_PIPE, buffer,
+                     (size_t) length < sizeof(buffer) ? (size_t) length : sizeof(buffer) - 1);
+    }
+}
+
+void log_event(ProcessState *state, const char *message) {
+    write_record(state, LOG_RECORD_EVENT, message, strlen(message));
+}
+
+void write_record(ProcessState *state, unsigned char kind, const char *text, size_t length) {
+    Logger *logger;
+
+    logger = &state->logger;
+    if (length > LOG_RECORD_LIMIT) {
+        length = LOG_RECORD_LIMIT;
+    }
+
+    switch (logger->mode) {
+        case LOG_ASYNC:
+            if (logger->region) {
+                unsigned char record[3 + LOG_RECORD_LIMIT];
+                unsigned short record_length;
+
+                record_length = (unsigned short) length;
+                record[0] = kind;
+                memcpy(&record[1], &record_length, sizeof(record_length));
+                memcpy(&record[3], text, length);
+                ring_write(log_ring(logger->region, state->id), NULL, -1, record, 3 + length);
+                break;
+            }
+            /* logger process isn't started yet, fall through */
+        case LOG_DIRECT:
+            write_direct(logger, kind, text, length);
+            break;
+        default:
+            append_record(logger, kind, text, length);
+    }
+}
+
+void write_direct(Logger *logger, unsigned char kind, const char *text, size_t length) {
+    if (kind == LOG_RECORD_EVENT) {
+        write_all(logger->evt_log, text, length);
+        write_all(STDOUT_FILENO, text, length);
+    } else if (kind == LOG_RECORD_PIPE) {
+        write_all(logger->pd_log, text, length);
+    }
+}
+
+void append_record(Logger *logger, unsigned char kind, const char *text, size_t length) {
+    char **buffer;
+    size_t *size;
+
+    if (kind == LOG_RECORD_EVENT) {
+        buffer = &logger->events;
+        size = &logger->events_size;
+    } else if (kind == LOG_RECORD_PIPE) {
+        buffer = &logger->pipes;
+        size = &logger->pipes_size;
+    } else {
+        return;
+    }
+
+    if (!*buffer && !(*buffer = malloc(LOG_BUFFER_SIZE))) {
+        write_direct(logger, kind, text, length);
+        return;
+    }
+    if (*size + length > LOG_BUFFER_SIZE) {
+        flush_buffers(logger);
+    }
+
+    memcpy(&(*buffer)[*size], text, length);
+    *size += length;
+}
+
+void flush_buffers(Logger *logger) {
+    if (logger->events_size) {
+        write_all(logger->evt_log, logger->events, logger->events_size);
+        write_all(STDOUT_FILENO, logger->events, logger->events_size);
+        logger->events_size = 0;
+    }
+    if (logger->pipes_size) {
+        write_all(logger->pd_log, logger->pipes, logger->pipes_size);
+        logger->pipes_size = 0;
+    }
+}
+
+void write_all(int descriptor, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written;
+
+        written = write(descriptor, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+}
+
+ShmRing *log_ring(struct LogRegion *region, local_id producer) {
+    char *rings;
+
+    rings = (char *) region + CACHE_LINE_SIZE;
+    return (ShmRing *) (rings + (size_t) producer * (sizeof(ShmRing) + SHM_RING_CAPACITY));
+}
+
+int drain_logs(Logger *logger, pid_t parent) {
+    struct timespec pause;
+    int closing, drained;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = LOG_IDLE_SLEEP * 1000L;
+    closing = 0;
+
+    do {
+        long id;
+
+        drained = 0;
+        for (id = 0; id <= logger->region->producers; ++id) {
+            ShmRing *ring;
+
+            ring = log_ring(logger->region, (local_id) id);
+            while (ring_available(ring) > 0) {
+                unsigned char kind;
+                unsigned short length;
+                char text[LOG_RECORD_LIMIT];
+
+                ring_read(ring, NULL, -1, &kind, sizeof(kind));
+                ring_read(ring, NULL, -1, &length, sizeof(length));
+                ring_read(ring, NULL, -1, text, length);
+                if (kind == LOG_RECORD_CLOSE) {
+                    closing = 1;
+                } else {
+                    append_record(logger, kind, text, length);
+                }
+                drained = 1;
+            }
+        }
+
+        if (!drained) {
+            flush_buffers(logger);
+            if (getppid() != parent) {
+                closing = 1;
+            } else if (!closing) {
+                nanosleep(&pause, NULL);
+            }
+        }
+    } while (!closing || drained);
+
+    flush_buffers(logger);
+    free(logger->events);
+    free(logger->pipes);
+
+    return 0;
+}
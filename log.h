@@ -0,0 +1,47 @@
+#include "core.h"
+
+#ifndef PA1_LOG_H
+#define PA1_LOG_H
+
+enum {
+    LOG_BUFFER_SIZE = 1 << 14,   ///< Size of buffer of single log in bytes (only for LOG_BUFFERED)
+    LOG_RECORD_LIMIT = 1024,     ///< Maximum length of single log record in bytes
+    LOG_IDLE_SLEEP = 100         ///< Sleep of idle logger process in microseconds
+};
+
+/**
+ * Initializes log of current process. Log files are kept opened by caller.
+ *
+ * @param logger log to initialize
+ * @param options options of run
+ * @param evt_log events log file descriptor
+ * @param pd_log pipes events log file descriptor
+ */
+void init_log(Logger *logger, const Options *options, int evt_log, int pd_log);
+
+/**
+ * Starts logger process draining shared rings if LOG_ASYNC is chosen. Must
+ * be called by parent before any channel is created, so logger doesn't
+ * inherit descriptors of channels.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int start_logger(ProcessState *state);
+
+/**
+ * Writes buffered records of current process to log files.
+ *
+ * @param state a state of current process
+ */
+void flush_log(ProcessState *state);
+
+/**
+ * Flushes and releases log of current process. Parent also stops logger
+ * process, so it must be called after all children are joined.
+ *
+ * @param state a state of current process
+ */
+void close_log(ProcessState *state);
+
+#endif //PA1_LOG_H
@@ -5,21 +5,153 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
-#include <stdarg.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "ipc.h"
 #include "pipes.h"
+#include "shm.h"
+#include "queues.h"
+#include "batch.h"
+#include "connections.h"
+#include "log.h"
+#include "bench.h"
+#include "bank.h"
+#include "pool.h"
+#include "counters.h"
+#include "trace.h"
+#include "detector.h"
 #include "distributed.h"
 #include "common.h"
 #include "phases.h"
 #include "core.h"
 
+/**
+ * Child running as thread of parent process.
+ */
+typedef struct {
+    pthread_t           thread;  ///< Thread of child
+    local_id            id;      ///< Local identifier of child
+    const Options      *options; ///< Options of run
+    const ProcessState *parent;  ///< State of parent with queues and log rings shared with child
+    int                 evt_log; ///< Events log file descriptor
+    int                 pd_log;  ///< Pipes events log file descriptor
+    int                 result;  ///< Result of child, 0 if success
+} ChildThread;
+
+/**
+ * Parses command line arguments: -p X [B1 ... BX] [-m process|thread] [-f serial|tree] [-t pipes|shm|sockets]
+ * [-c all|dissemination] [-b BYTES] [-d MICROSECONDS] [-n] [-k] [-l direct|buffered|async] [-v LEVEL]
+ * [-B pingpong|multicast|barrier|stream|all] [-i ITERATIONS] [-j JOBS] [-w MILLISECONDS] [-z] [-s] [-T]
+ * [--mutexl].
+ *
+ * @param argc count of arguments
+ * @param argv arguments
+ * @param options parsed options
+ * @return 0 if success
+ */
+int parse_arguments(int argc, const char *argv[], Options *options);
+
+/**
+ * Initializes state of process with given identifier and allocates its
+ * tables sized by count of processes.
+ *
+ * @param state a state to initialize
+ * @param id local process identifier
+ * @param options options of run
+ * @param evt_log events log file descriptor
+ * @param pd_log pipes events log file descriptor
+ * @return 0 if success
+ */
+int init_state(ProcessState *state, local_id id, const Options *options, int evt_log, int pd_log);
+
+/**
+ * Releases tables of process state allocated by init_state().
+ *
+ * @param state a state to release
+ */
+void release_state(ProcessState *state);
+
+/**
+ * Initializes channels of chosen transport before fork.
+ *
+ * @param state a state of parent process
+ * @param pipes_descriptors matrix for pipes descriptors (only for TRANSPORT_PIPES)
+ * @param sockets descriptors by child identifier (only for TRANSPORT_SOCKETS)
+ * @return 0 if success
+ */
+int init_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                  ChildSockets *sockets);
+
+/**
+ * Prepares channels of chosen transport after fork.
+ *
+ * @param state a state of current process
+ * @param pipes_descriptors matrix of pipes descriptors (only for TRANSPORT_PIPES)
+ * @param sockets descriptors by child identifier (only for TRANSPORT_SOCKETS)
+ * @return 0 if success
+ */
+int prepare_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                     ChildSockets *sockets);
+
+/**
+ * Closes all channels of chosen transport created before fork.
+ *
+ * @param state a state of current process
+ * @param pipes_descriptors matrix of pipes descriptors (only for TRANSPORT_PIPES)
+ * @param sockets descriptors by child identifier (only for TRANSPORT_SOCKETS)
+ */
+void close_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                    ChildSockets *sockets);
+
+/**
+ * Returns identifier of the next child to fork by current process. Serial
+ * launcher forks all children from parent. Tree launcher makes process i fork
+ * i + 2^k for every 2^k > i, larger subtrees first, so every process is
+ * forked after ceil(log2(N + 1)) levels of forks running in parallel.
+ *
+ * @param options options of run
+ * @param self identifier of current process
+ * @param previous identifier of previously forked child, self if nothing was forked yet
+ * @return identifier of child to fork or 0 if current process forks nothing more
+ */
+long next_spawn(const Options *options, long self, long previous);
+
+/**
+ * Publishes exit of process that wasn't forked and of all processes it
+ * would fork, so processes already forked don't wait for them.
+ *
+ * @param state a state of current process
+ * @param options options of run
+ * @param id identifier of process that wasn't forked
+ */
+void abandon_subtree(ProcessState *state, const Options *options, long id);
+
 /**
  * Joins created processes.
  *
  * @param count a processes count to join
  */
-void join_processes(local_id count);
+void join_processes(long count);
+
+/**
+ * Runs children as threads of parent process, executes parent in current
+ * thread and joins children. Queues between threads must be initialized.
+ *
+ * @param parent_state a state of parent process
+ * @param options options of run
+ * @param evt_log events log file descriptor
+ * @param pd_log pipes events log file descriptor
+ * @return 0 if success
+ */
+int execute_threads(ProcessState *parent_state, const Options *options, int evt_log, int pd_log);
+
+/**
+ * Entry point of child thread.
+ *
+ * @param context child thread
+ * @return NULL
+ */
+void *execute_thread(void *context);
 
 /**
  * Executes phases for child process.
@@ -38,19 +170,45 @@ int execute_child(ProcessState *state);
 int execute_parent(ProcessState *state);
 
 int main(int argc, const char *argv[]) {
-    long processes_count;
-    int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2];
+    long processes_count, self, forked, id;
+    Options options;
     int evt_log, pd_log;
     ProcessState parent_state;
 
-    if (argc != 3 || strcmp(argv[1], "-p") != 0) {
-        fprintf(stderr, "Usage %s -p X, where X is number of child processes.\n", argv[0]);
+    if (parse_arguments(argc, argv, &options)) {
+        fprintf(stderr, "Usage %s -p X [B1 ... BX] [-m process|thread] [-f serial|tree] [-t pipes|shm|sockets] "
+                "[-c all|dissemination] [-b BYTES] [-d MICROSECONDS] [-n] [-k] [-l direct|buffered|async] [-v LEVEL] "
+                "[-B pingpong|multicast|barrier|stream|all] [-i ITERATIONS] [-j JOBS] [-w MILLISECONDS] [-z] [-s] "
+                "[-T] [--mutexl], where X is number of child processes, B1 ... BX are initial balances of accounts to "
+                "run bank, -m runs children as processes or as threads sharing message queues, -f forks children from "
+                "parent or in tree, -c chooses barrier algorithm, BYTES and MICROSECONDS are size and age of batch to "
+                "flush, -n switches pipes to non-blocking reads, -k coalesces control messages until process blocks, "
+                "-l chooses a way to write logs, LEVEL is 0 to log only events or 1 to log pipes too, -B runs "
+                "benchmark workload with ITERATIONS measured iterations instead of phases, -j runs phases JOBS times "
+                "by the same children without bank, -w fails receives from peers silent for MILLISECONDS, -z "
+                "compresses large payloads, -s dumps counters of traffic to counters.log, -T exports timeline of "
+                "messages and phases to trace.json, --mutexl makes children enter critical section in "
+                "loop.\n", argv[0]);
         return 1;
     }
-    processes_count = strtol(argv[2], NULL, 10);
+    processes_count = options.processes_count;
+
+    if (processes_count > MAX_PROCESSES_COUNT) {
+        fprintf(stderr, "Too much processes to create: actual=%ld limit=%d\n", processes_count, MAX_PROCESSES_COUNT);
+        return 2;
+    }
+
+    int (*pipes_descriptors)[(processes_count + 1) * 2] = NULL;
+    ChildSockets *sockets = NULL;
 
-    if (processes_count > MAX_PROCESS_ID) {
-        fprintf(stderr, "Too much processes to create: actual=%ld limit=%d\n", processes_count, MAX_PROCESS_ID);
+    if (options.transport == TRANSPORT_PIPES) {
+        pipes_descriptors = malloc(sizeof(int[processes_count + 1][(processes_count + 1) * 2]));
+    } else if (options.transport == TRANSPORT_SOCKETS) {
+        sockets = calloc((size_t) processes_count + 1, sizeof(ChildSockets));
+    }
+    if ((options.transport == TRANSPORT_PIPES || options.transport == TRANSPORT_SOCKETS)
+        && !pipes_descriptors && !sockets) {
+        fprintf(stderr, "Failed to allocate channels descriptors!\n");
         return 2;
     }
 
@@ -67,72 +225,424 @@ int main(int argc, const char *argv[]) {
         return 4;
     }
 
-    parent_state.id = PARENT_ID;
-    parent_state.processes_count = processes_count;
-    parent_state.evt_log = evt_log;
-    parent_state.pd_log = pd_log;
+    if (init_state(&parent_state, PARENT_ID, &options, evt_log, pd_log)) {
+        fprintf(stderr, "Failed to initialize parent state!\n");
+        close(pd_log);
+        close(evt_log);
+        return 5;
+    }
+
+    if (start_logger(&parent_state)) {
+        fprintf(stderr, "Failed to start logger!\n");
+        release_state(&parent_state);
+        close(pd_log);
+        close(evt_log);
+        return 5;
+    }
+
+    if (options.trace && init_trace(&parent_state)) {
+        fprintf(stderr, "Failed to initialize trace!\n");
+        close_log(&parent_state);
+        close(pd_log);
+        close(evt_log);
+        return 5;
+    }
 
-    if (init_pipes(&parent_state, pipes_descriptors)) {
-        fprintf(stderr, "Failed to initialize pipes descriptors!\n");
+    if (init_detector(&parent_state, options.detector_timeout)) {
+        fprintf(stderr, "Failed to initialize failure detector!\n");
+        close_log(&parent_state);
         close(pd_log);
+        close(evt_log);
         return 5;
     }
 
-    for (local_id id = 1; id <= processes_count; ++id) {
+    if (init_channels(&parent_state, pipes_descriptors, sockets)) {
+        fprintf(stderr, "Failed to initialize channels!\n");
+        close_log(&parent_state);
+        close(pd_log);
+        close(evt_log);
+        return 5;
+    }
+    flush_log(&parent_state);
+
+    if (options.runtime == RUNTIME_THREADS) {
+        int result;
+
+        result = execute_threads(&parent_state, &options, evt_log, pd_log);
+        close(pd_log);
+        close(evt_log);
+        return result;
+    }
+
+    self = PARENT_ID;
+    forked = 0;
+    for (id = next_spawn(&options, self, self); id; id = next_spawn(&options, self, id)) {
         pid_t pid;
 
         pid = fork();
         if (pid < 0) {
-            fprintf(stderr, "Failed to fork process: id=%d\n", id);
-            close_pipes(&parent_state, pipes_descriptors);
+            fprintf(stderr, "Failed to fork process: id=%ld\n", id);
+            for (; id; id = next_spawn(&options, self, id)) {
+                abandon_subtree(&parent_state, &options, id);
+            }
+            publish_exit(&parent_state, (local_id) self);
+            close_channels(&parent_state, pipes_descriptors, sockets);
+            join_processes(forked);
+            if (self == PARENT_ID) {
+                close_log(&parent_state);
+            }
             close(pd_log);
             close(evt_log);
-            join_processes(id);
             return -1;
         } else if (!pid) {
-            int result;
-            ProcessState process_state;
+            self = id;
+            forked = 0;
+        } else {
+            ++forked;
+        }
+    }
 
-            process_state.id = id;
-            process_state.processes_count = processes_count;
-            process_state.evt_log = evt_log;
-            process_state.pd_log = pd_log;
+    if (self != PARENT_ID) {
+        int result;
+        ProcessState process_state;
 
-            if (prepare_pipes(&process_state, pipes_descriptors)) {
-                fprintf(stderr, "(%d) Failed to prepare pipes.\n", id);
-                close_pipes(&process_state, pipes_descriptors);
-                return 1;
-            }
+        if (init_state(&process_state, (local_id) self, &options, evt_log, pd_log)) {
+            fprintf(stderr, "(%ld) Failed to initialize state.\n", self);
+            publish_exit(&parent_state, (local_id) self);
+            join_processes(forked);
+            return 1;
+        }
+        process_state.shm = parent_state.shm;
+        process_state.logger.region = parent_state.logger.region;
+        process_state.trace = parent_state.trace;
+        process_state.detector = parent_state.detector;
 
-            if ((result = execute_child(&process_state))) {
-                fprintf(stderr, "(%d) Failed to execute child!\n", id);
-            }
-            close(pd_log);
-            close(evt_log);
-            return result;
+        if (prepare_channels(&process_state, pipes_descriptors, sockets)) {
+            fprintf(stderr, "(%ld) Failed to prepare channels.\n", self);
+            leave_detector(&process_state);
+            close_channels(&process_state, pipes_descriptors, sockets);
+            close_log(&process_state);
+            join_processes(forked);
+            return 1;
         }
+        free(pipes_descriptors);
+        free(sockets);
+
+        result = options.bench != BENCH_NONE
+                 ? execute_bench(&process_state, options.bench, options.bench_iterations)
+                 : execute_child(&process_state);
+        if (result) {
+            fprintf(stderr, "(%ld) Failed to execute child!\n", self);
+        }
+        leave_detector(&process_state);
+        release_state(&process_state);
+        close_log(&process_state);
+        close(pd_log);
+        close(evt_log);
+        join_processes(forked);
+        return result;
     }
 
     {
         int result;
 
-        if (prepare_pipes(&parent_state, pipes_descriptors)) {
-            fprintf(stderr, "Failed to prepare parent pipes\n");
-            close_pipes(&parent_state, pipes_descriptors);
+        if (prepare_channels(&parent_state, pipes_descriptors, sockets)) {
+            fprintf(stderr, "Failed to prepare parent channels\n");
+            close_channels(&parent_state, pipes_descriptors, sockets);
             return 1;
         }
+        free(pipes_descriptors);
+        free(sockets);
 
-        if ((result = execute_parent(&parent_state))) {
+        result = options.bench != BENCH_NONE
+                 ? execute_bench(&parent_state, options.bench, options.bench_iterations)
+                 : execute_parent(&parent_state);
+        if (result) {
             fprintf(stderr, "Failed to execute parent!\n");
         }
+        leave_detector(&parent_state);
+        release_state(&parent_state);
+        join_processes(forked);
+        export_trace(&parent_state);
+        cleanup_detector(&parent_state);
+        close_log(&parent_state);
         close(pd_log);
         close(evt_log);
-        join_processes((local_id) processes_count);
         return result;
     }
 }
 
-void join_processes(local_id count) {
+int parse_arguments(int argc, const char *argv[], Options *options) {
+    int i;
+
+    options->processes_count = -1;
+    options->runtime = RUNTIME_PROCESSES;
+    options->launcher = LAUNCHER_SERIAL;
+    options->transport = TRANSPORT_PIPES;
+    options->batch_limit = 0;
+    options->batch_delay = BATCH_DEFAULT_DELAY;
+    options->nonblocking = 0;
+    options->coalesce = 0;
+    options->barrier_kind = BARRIER_ALL_TO_ALL;
+    options->log_mode = LOG_BUFFERED;
+    options->log_level = LOG_LEVEL_PIPES;
+    options->bench = BENCH_NONE;
+    options->bench_iterations = BENCH_DEFAULT_ITERATIONS;
+    options->mutexl = 0;
+    options->compress = 0;
+    options->jobs = 1;
+    options->detector_timeout = -1;
+    options->counters = 0;
+    options->trace = 0;
+    options->balances = NULL;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0) {
+            options->nonblocking = 1;
+        } else if (strcmp(argv[i], "-k") == 0) {
+            options->coalesce = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options->counters = 1;
+        } else if (strcmp(argv[i], "-T") == 0) {
+            options->trace = 1;
+        } else if (strcmp(argv[i], "-z") == 0) {
+            options->compress = 1;
+        } else if (strcmp(argv[i], "--mutexl") == 0) {
+            options->mutexl = 1;
+        } else if (i + 1 == argc) {
+            return 1;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            options->processes_count = strtol(argv[++i], NULL, 10);
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                if (options->processes_count < 1 || options->processes_count >= argc - i) {
+                    return 1;
+                }
+                options->balances = &argv[i + 1];
+                i += options->processes_count;
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            ++i;
+            if (strcmp(argv[i], "process") == 0) {
+                options->runtime = RUNTIME_PROCESSES;
+            } else if (strcmp(argv[i], "thread") == 0) {
+                options->runtime = RUNTIME_THREADS;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0) {
+            ++i;
+            if (strcmp(argv[i], "serial") == 0) {
+                options->launcher = LAUNCHER_SERIAL;
+            } else if (strcmp(argv[i], "tree") == 0) {
+                options->launcher = LAUNCHER_TREE;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0) {
+            ++i;
+            if (strcmp(argv[i], "pipes") == 0) {
+                options->transport = TRANSPORT_PIPES;
+            } else if (strcmp(argv[i], "shm") == 0) {
+                options->transport = TRANSPORT_SHM;
+            } else if (strcmp(argv[i], "sockets") == 0) {
+                options->transport = TRANSPORT_SOCKETS;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            ++i;
+            if (strcmp(argv[i], "all") == 0) {
+                options->barrier_kind = BARRIER_ALL_TO_ALL;
+            } else if (strcmp(argv[i], "dissemination") == 0) {
+                options->barrier_kind = BARRIER_DISSEMINATION;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0) {
+            ++i;
+            if (strcmp(argv[i], "direct") == 0) {
+                options->log_mode = LOG_DIRECT;
+            } else if (strcmp(argv[i], "buffered") == 0) {
+                options->log_mode = LOG_BUFFERED;
+            } else if (strcmp(argv[i], "async") == 0) {
+                options->log_mode = LOG_ASYNC;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-v") == 0) {
+            options->log_level = strtol(argv[++i], NULL, 10) > 0 ? LOG_LEVEL_PIPES : LOG_LEVEL_EVENTS;
+        } else if (strcmp(argv[i], "-B") == 0) {
+            ++i;
+            if (strcmp(argv[i], "pingpong") == 0) {
+                options->bench = BENCH_PINGPONG;
+            } else if (strcmp(argv[i], "multicast") == 0) {
+                options->bench = BENCH_MULTICAST;
+            } else if (strcmp(argv[i], "barrier") == 0) {
+                options->bench = BENCH_BARRIER;
+            } else if (strcmp(argv[i], "stream") == 0) {
+                options->bench = BENCH_STREAM;
+            } else if (strcmp(argv[i], "all") == 0) {
+                options->bench = BENCH_ALL;
+            } else {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            options->jobs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            options->detector_timeout = (int) strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            options->bench_iterations = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            options->batch_limit = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            options->batch_delay = strtol(argv[++i], NULL, 10);
+        } else {
+            return 1;
+        }
+    }
+
+    if (options->runtime == RUNTIME_THREADS) {
+        options->transport = TRANSPORT_QUEUES;
+    }
+
+    return options->processes_count < 0 || options->batch_delay < 0 || options->bench_iterations < 0
+           || options->jobs < 1 || (options->jobs > 1 && options->balances);
+}
+
+int init_state(ProcessState *state, local_id id, const Options *options, int evt_log, int pd_log) {
+    size_t total;
+
+    memset(state, 0, sizeof(ProcessState));
+    state->id = id;
+    state->processes_count = options->processes_count;
+    init_log(&state->logger, options, evt_log, pd_log);
+    state->transport = options->transport;
+    state->shm = NULL;
+    state->last_from = PARENT_ID;
+    state->local_time = 0;
+    state->batch_limit = options->batch_limit;
+    state->batch_delay = options->batch_delay;
+    state->nonblocking = options->nonblocking;
+    state->coalesce = options->coalesce;
+    state->barrier_kind = options->barrier_kind;
+    state->mutexl = options->mutexl;
+    state->compress = options->compress;
+    state->jobs = options->jobs;
+    state->cs_state = CS_IDLE;
+
+    total = (size_t) options->processes_count + 1;
+    state->reading_pipes = calloc(total, sizeof(int));
+    state->writing_pipes = calloc(total, sizeof(int));
+    state->batches = calloc(total, sizeof(OutputBatch));
+    state->inputs = calloc(total, sizeof(InputBuffer));
+    state->control_sockets = calloc(total, sizeof(int));
+    state->requested = calloc(total, sizeof(char));
+    state->deferred = calloc(total, sizeof(char));
+    state->done_received = calloc(total, sizeof(char));
+    state->dead = calloc(total, sizeof(char));
+    if (!state->reading_pipes || !state->writing_pipes || !state->batches || !state->inputs
+        || !state->control_sockets || !state->requested || !state->deferred || !state->done_received || !state->dead
+        || init_bank(state, options) || (options->counters && init_counters(state))) {
+        release_state(state);
+        return 1;
+    }
+
+    return 0;
+}
+
+void release_state(ProcessState *state) {
+    free(state->reading_pipes);
+    free(state->writing_pipes);
+    free(state->batches);
+    free(state->inputs);
+    free(state->control_sockets);
+    free(state->requested);
+    free(state->deferred);
+    free(state->done_received);
+    free(state->dead);
+    release_bank(state);
+    release_pool(state);
+    release_counters(state);
+    state->control_sockets = NULL;
+    state->requested = NULL;
+    state->deferred = state->done_received = state->dead = NULL;
+    state->reading_pipes = state->writing_pipes = NULL;
+    state->batches = NULL;
+    state->inputs = NULL;
+}
+
+int init_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                  ChildSockets *sockets) {
+    switch (state->transport) {
+        case TRANSPORT_SHM:
+        case TRANSPORT_QUEUES:
+            return init_shm(state);
+        case TRANSPORT_SOCKETS:
+            return init_connections(state, sockets);
+        default:
+            return init_pipes(state, pipes_descriptors);
+    }
+}
+
+int prepare_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                     ChildSockets *sockets) {
+    switch (state->transport) {
+        case TRANSPORT_SHM:
+        case TRANSPORT_QUEUES:
+            return 0;
+        case TRANSPORT_SOCKETS:
+            return prepare_connections(state, sockets);
+        default:
+            return prepare_pipes(state, pipes_descriptors);
+    }
+}
+
+void close_channels(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2],
+                    ChildSockets *sockets) {
+    switch (state->transport) {
+        case TRANSPORT_SHM:
+            cleanup_shm(state);
+            break;
+        case TRANSPORT_QUEUES:
+            cleanup_queues(state);
+            break;
+        case TRANSPORT_SOCKETS:
+            close_connections(state, sockets);
+            break;
+        default:
+            close_pipes(state, pipes_descriptors);
+    }
+}
+
+long next_spawn(const Options *options, long self, long previous) {
+    long step, next;
+
+    if (options->launcher == LAUNCHER_SERIAL) {
+        next = self == PARENT_ID ? previous + 1 : 0;
+    } else {
+        step = previous - self;
+        if (!step) {
+            for (step = 1; step <= self; step *= 2) {
+            }
+        } else {
+            step *= 2;
+        }
+        next = self + step;
+    }
+
+    return next && next <= options->processes_count ? next : 0;
+}
+
+void abandon_subtree(ProcessState *state, const Options *options, long id) {
+    long child;
+
+    publish_exit(state, (local_id) id);
+    for (child = next_spawn(options, id, id); child; child = next_spawn(options, id, child)) {
+        abandon_subtree(state, options, child);
+    }
+}
+
+void join_processes(long count) {
     for (int i = 1; i <= count; ++i) {
         pid_t pid;
         int status;
@@ -153,61 +663,125 @@ void join_processes(local_id count) {
     }
 }
 
-void log_pipe(ProcessState *state, const char *fmt, ...) {
-    va_list args;
-    char buffer[1024];
+int execute_threads(ProcessState *parent_state, const Options *options, int evt_log, int pd_log) {
+    ChildThread *threads;
+    long count, id;
+    int result;
 
-    va_start(args, fmt);
-    vsprintf(buffer, fmt, args);
-    write(state->pd_log, buffer, strlen(buffer));
-    va_end(args);
-}
+    count = parent_state->processes_count;
+    threads = calloc((size_t) count + 1, sizeof(ChildThread));
+    if (!threads) {
+        fprintf(stderr, "Failed to allocate threads!\n");
+        close_channels(parent_state, NULL, NULL);
+        close_log(parent_state);
+        return 2;
+    }
 
-void log_event(ProcessState *state, const char *message) {
-    write(state->evt_log, message, strlen(message));
-    printf("%s", message);
-}
+    for (id = 1; id <= count; ++id) {
+        int error;
 
-int execute_child(ProcessState *state) {
-    if (child_phase_1(state)) {
-        fprintf(stderr, "(%d) Failed to execute first phase!\n", state->id);
-        cleanup_pipes(state);
-        return 1;
+        threads[id].id = (local_id) id;
+        threads[id].options = options;
+        threads[id].parent = parent_state;
+        threads[id].evt_log = evt_log;
+        threads[id].pd_log = pd_log;
+        if ((error = pthread_create(&threads[id].thread, NULL, execute_thread, &threads[id]))) {
+            fprintf(stderr, "Failed to create thread: id=%ld error=%s\n", id, strerror(error));
+            break;
+        }
     }
-    if (child_phase_2(state)) {
-        fprintf(stderr, "(%d) Failed to execute second phase!\n", state->id);
-        cleanup_pipes(state);
-        return 2;
+    if (id <= count) {
+        long created;
+
+        /* threads already created wait for the rest, so they fail and are joined */
+        for (created = id - 1; id <= count; ++id) {
+            publish_exit(parent_state, (local_id) id);
+        }
+        leave_detector(parent_state);
+        release_state(parent_state);
+        for (id = 1; id <= created; ++id) {
+            pthread_join(threads[id].thread, NULL);
+        }
+        free(threads);
+
+        cleanup_queues(parent_state);
+        cleanup_detector(parent_state);
+        close_log(parent_state);
+        return -1;
     }
-    if (child_phase_3(state)) {
-        fprintf(stderr, "(%d) Failed to execute third phase!\n", state->id);
-        cleanup_pipes(state);
-        return 3;
+
+    result = options->bench != BENCH_NONE
+             ? execute_bench(parent_state, options->bench, options->bench_iterations)
+             : execute_parent(parent_state);
+    if (result) {
+        fprintf(stderr, "Failed to execute parent!\n");
     }
+    leave_detector(parent_state);
+    release_state(parent_state);
 
-    cleanup_pipes(state);
+    for (id = 1; id <= count; ++id) {
+        pthread_join(threads[id].thread, NULL);
+        if (threads[id].result) {
+            fprintf(stderr, "Child thread exits abnormally: id=%ld result=%d\n", id, threads[id].result);
+        }
+    }
+    free(threads);
 
-    return 0;
+    cleanup_queues(parent_state);
+    export_trace(parent_state);
+    cleanup_detector(parent_state);
+    close_log(parent_state);
+    return result;
 }
 
-int execute_parent(ProcessState *state) {
-    if (parent_phase_1(state)) {
-        fprintf(stderr, "Failed to execute first parent phase\n");
-        cleanup_pipes(state);
-        return 1;
-    }
-    if (parent_phase_2(state)) {
-        fprintf(stderr, "Failed to execute second parent phase\n");
-        cleanup_pipes(state);
-        return 2;
+void *execute_thread(void *context) {
+    ChildThread *child;
+    ProcessState process_state;
+
+    child = context;
+    if (init_state(&process_state, child->id, child->options, child->evt_log, child->pd_log)) {
+        fprintf(stderr, "(%d) Failed to initialize state.\n", child->id);
+        publish_exit(child->parent, child->id);
+        child->result = 1;
+        return NULL;
     }
-    if (parent_phase_3(state)) {
-        fprintf(stderr, "Failed to execute third parent phase\n");
-        cleanup_pipes(state);
-        return 3;
+    process_state.shm = child->parent->shm;
+    process_state.logger.region = child->parent->logger.region;
+    process_state.trace = child->parent->trace;
+    process_state.detector = child->parent->detector;
+
+    child->result = child->options->bench != BENCH_NONE
+                    ? execute_bench(&process_state, child->options->bench, child->options->bench_iterations)
+                    : execute_child(&process_state);
+    if (child->result) {
+        fprintf(stderr, "(%d) Failed to execute child!\n", child->id);
     }
+    leave_detector(&process_state);
+    release_state(&process_state);
 
-    cleanup_pipes(state);
+    /* log rings are shared with parent, which unmaps them after join */
+    process_state.logger.region = NULL;
+    close_log(&process_state);
 
-    return 0;
+    return NULL;
+}
+
+int execute_child(ProcessState *state) {
+    int result;
+
+    result = run_child_jobs(state);
+    cleanup_channels(state);
+    dump_counters(state);
+
+    return result;
+}
+
+int execute_parent(ProcessState *state) {
+    int result;
+
+    result = run_parent_jobs(state);
+    cleanup_channels(state);
+    dump_counters(state);
+
+    return result;
 }
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include "mutex.h"
+#include "distributed.h"
+#include "counters.h"
+
+/**
+ * Handles message received while waiting for replies or DONE messages:
+ * request of critical section is replied or deferred, DONE is remembered.
+ * Sender of message is taken from state->last_from.
+ *
+ * @param state a state of current process
+ * @param message received message
+ * @return 0 if success
+ */
+int serve_cs_message(ProcessState *state, const Message *message);
+
+/**
+ * Initializes header of empty message.
+ *
+ * @param message message to initialize
+ * @param message_type type of message
+ */
+void init_cs_message(Message *message, int message_type);
+
+int request_cs(const void *self) {
+    ProcessState *state = (ProcessState *) self;
+    char peers[state->processes_count + 1];
+    Message message;
+    long replies;
+
+    peers[PARENT_ID] = 0;
+    replies = 0;
+    for (int id = 1; id <= state->processes_count; ++id) {
+        peers[id] = id != state->id;
+        replies += peers[id];
+    }
+
+    init_cs_message(&message, CS_REQUEST);
+    if (send_multicast_to(state, peers, &message)) {
+        fprintf(stderr, "(%d) Failed to request critical section\n", state->id);
+        return 1;
+    }
+    state->cs_state = CS_WAITING;
+    state->cs_time = state->local_time;
+
+    while (replies > 0) {
+        if (receive_any_of(state, peers, &message)) {
+            fprintf(stderr, "(%d) Failed to receive reply to request of critical section\n", state->id);
+            return 2;
+        }
+        if (serve_cs_message(state, &message)) {
+            return 3;
+        }
+        if (message.s_header.s_type == CS_REPLY) {
+            --replies;
+        }
+    }
+    state->cs_state = CS_HELD;
+
+    return 0;
+}
+
+int release_cs(const void *self) {
+    ProcessState *state = (ProcessState *) self;
+    Message message;
+    int deferred;
+
+    state->cs_state = CS_IDLE;
+
+    deferred = 0;
+    for (int id = 0; id <= state->processes_count; ++id) {
+        deferred |= state->deferred[id];
+    }
+    if (!deferred) {
+        return 0;
+    }
+
+    init_cs_message(&message, CS_REPLY);
+    if (send_multicast_to(state, state->deferred, &message)) {
+        fprintf(stderr, "(%d) Failed to send deferred replies\n", state->id);
+        return 1;
+    }
+    for (int id = 0; id <= state->processes_count; ++id) {
+        state->deferred[id] = 0;
+    }
+
+    return 0;
+}
+
+int receive_done_serving_cs(ProcessState *state) {
+    char pending[state->processes_count + 1];
+    Message message;
+    long remaining;
+    long long started;
+
+    remaining = 0;
+    for (int id = 0; id <= state->processes_count; ++id) {
+        pending[id] = id != PARENT_ID && id != state->id && !state->done_received[id];
+        remaining += pending[id];
+    }
+
+    started = counters_clock(state);
+    while (remaining > 0) {
+        if (receive_any_of(state, pending, &message)) {
+            fprintf(stderr, "(%d) Failed to receive message from any process\n", state->id);
+            return 1;
+        }
+        if (serve_cs_message(state, &message)) {
+            return 2;
+        }
+        if (message.s_header.s_type == DONE) {
+            count_arrival(state, state->last_from, started);
+            pending[state->last_from] = 0;
+            --remaining;
+        }
+    }
+
+    count_barrier(state, started);
+    return 0;
+}
+
+int serve_cs_message(ProcessState *state, const Message *message) {
+    local_id from;
+    timestamp_t time;
+
+    from = state->last_from;
+    time = message->s_header.s_local_time;
+
+    switch (message->s_header.s_type) {
+        case CS_REQUEST:
+            if (state->cs_state == CS_HELD
+                || (state->cs_state == CS_WAITING
+                    && (state->cs_time < time || (state->cs_time == time && state->id < from)))) {
+                state->deferred[from] = 1;
+            } else {
+                Message reply;
+
+                init_cs_message(&reply, CS_REPLY);
+                if (send(state, from, &reply)) {
+                    fprintf(stderr, "(%d) Failed to reply to request of critical section: to=%d\n",
+                            state->id, from);
+                    return 1;
+                }
+            }
+            return 0;
+        case CS_REPLY:
+            return 0;
+        case DONE:
+            state->done_received[from] = 1;
+            return 0;
+        default:
+            fprintf(stderr, "(%d) Message has incorrect type: from=%d type=%d\n",
+                    state->id, from, message->s_header.s_type);
+            return 1;
+    }
+}
+
+void init_cs_message(Message *message, int message_type) {
+    message->s_header.s_magic = MESSAGE_MAGIC;
+    message->s_header.s_type = (int16_t) message_type;
+    message->s_header.s_payload_len = 0;
+    message->s_header.s_local_time = 0;
+}
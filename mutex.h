@@ -0,0 +1,35 @@
+#include "core.h"
+
+#ifndef PA1_MUTEX_H
+#define PA1_MUTEX_H
+
+/**
+ * Enters critical section shared by children with Ricart-Agrawala algorithm:
+ * request is multicast to all other children with single Lamport time and
+ * process waits for their replies, serving requests of others meanwhile.
+ * Every entry costs 2 * (N - 1) messages.
+ *
+ * @param self a state of current child process
+ * @return 0 if success
+ */
+int request_cs(const void *self);
+
+/**
+ * Leaves critical section and replies to all deferred requests in one pass.
+ *
+ * @param self a state of current child process
+ * @return 0 if success
+ */
+int release_cs(const void *self);
+
+/**
+ * Receives DONE from all children except ones whose DONE was already received
+ * while waiting for critical section, replying to requests of critical
+ * section meanwhile.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int receive_done_serving_cs(ProcessState *state);
+
+#endif //PA1_MUTEX_H
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include "phases.h"
+#include "log.h"
+#include "trace.h"
+
+int run_phases(ProcessState *state, const Phase *phases, int count) {
+    unsigned completed, all;
+    int i;
+
+    all = count < (int) (sizeof(unsigned) * 8) ? (1u << count) - 1 : ~0u;
+    completed = 0;
+    for (i = 0; i < count; ++i) {
+        if (phases[i].enabled && !phases[i].enabled(state)) {
+            completed |= 1u << i;
+        }
+    }
+
+    while (completed != all) {
+        int next;
+
+        next = -1;
+        for (i = 0; i < count; ++i) {
+            if ((completed & 1u << i) || (phases[i].after & ~completed)) {
+                continue;
+            }
+            if (!phases[i].blocking) {
+                next = i;
+                break;
+            }
+            if (next < 0) {
+                next = i;
+            }
+        }
+        if (next < 0) {
+            fprintf(stderr, "(%d) Phases have cyclic dependencies\n", state->id);
+            return count + 1;
+        }
+
+        trace_event(state, TRACE_PHASE_BEGIN, state->id, 0, phases[next].name);
+        if (phases[next].run(state)) {
+            fprintf(stderr, "(%d) Failed to execute phase: name=%s\n", state->id, phases[next].name);
+            return next + 1;
+        }
+        trace_event(state, TRACE_PHASE_END, state->id, 0, phases[next].name);
+        completed |= 1u << next;
+        flush_log(state);
+    }
+
+    return 0;
+}
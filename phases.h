@@ -5,51 +5,68 @@
 #define PA1_PHASES_H
 
 /**
- * Implements first phase of child process (starting synchronization).
- *
- * @param state a state of current process
- * @return 0 if success
+ * Single phase of process registered in table of phases.
  */
-int child_phase_1(ProcessState *state);
+typedef struct {
+    const char *name;                          ///< Name of phase for error messages
+    int       (*run)(ProcessState *state);     ///< Runs phase, returns 0 if success
+    int       (*enabled)(ProcessState *state); ///< Returns non-zero if phase has work, NULL if it always has
+    unsigned    after;                         ///< Mask of phases (1 << index) that must be completed before
+    int         blocking;                      ///< Non-zero if phase waits for messages of other processes
+} Phase;
+
+enum {
+    CHILD_PHASES_COUNT = 6, ///< Count of phases in table of child process
+    PARENT_PHASES_COUNT = 4 ///< Count of phases in table of parent process
+};
 
 /**
- * Implements second phase of child process (some work).
- *
- * @param state a state of current process
- * @return 0 if success
+ * Phases of child process: starting synchronization, some work and done
+ * synchronization. Announcing of DONE waits for STARTED of all processes
+ * even without work, so events are logged in the order required by PA1.
  */
-int child_phase_2(ProcessState *state);
+extern const Phase child_phases[CHILD_PHASES_COUNT];
 
 /**
- * Implements third phase of child process (done synchronization).
- *
- * @param state a state of current process
- * @return 0 if success
+ * Phases of parent process: starting synchronization, some work and done
+ * synchronization.
  */
-int child_phase_3(ProcessState *state);
+extern const Phase parent_phases[PARENT_PHASES_COUNT];
 
 /**
- * Implements first phase of parent process (starting synchronization).
+ * Runs phases of table as soon as their dependencies are completed. Disabled
+ * phases are completed from the start, so phases that depend on them don't
+ * wait for anything extra. Among ready phases non-blocking ones run first,
+ * so messages to other processes are sent before current process waits.
+ * Logs are flushed after every phase.
  *
  * @param state a state of current process
- * @return 0 if success
+ * @param phases table of phases
+ * @param count count of phases, at most count of bits in unsigned
+ * @return 0 if success, otherwise index of failed phase plus one
  */
-int parent_phase_1(ProcessState *state);
+int run_phases(ProcessState *state, const Phase *phases, int count);
 
 /**
- * Implements second phase of parent process (some work).
+ * Runs phases of child process for every job of pool. Without pool phases
+ * are run once. In pool child waits for the next job from parent after every
+ * job: STARTED of parent starts the next one and STOP stops the pool.
  *
- * @param state a state of current process
+ * @param state a state of current child process
  * @return 0 if success
  */
-int parent_phase_2(ProcessState *state);
+int run_child_jobs(ProcessState *state);
 
 /**
- * Implements third phase of parent process (done synchronization).
+ * Runs phases of parent process for every job of pool and dispatches jobs
+ * to children over the same channels: STARTED before every job except the
+ * first and STOP after the last one. Messages of the next job can't be
+ * mixed up with messages of the previous one, because channels are FIFO and
+ * every process stops reading a peer once its barrier message has arrived.
  *
- * @param state a state of current process
+ * @param state a state of parent process
  * @return 0 if success
  */
-int parent_phase_3(ProcessState *state);
+int run_parent_jobs(ProcessState *state);
 
 #endif //PA1_PHASES_H
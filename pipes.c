@@ -1,17 +1,86 @@
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
 #include "pipes.h"
+#include "batch.h"
+#include "counters.h"
+#include "detector.h"
+
+enum {
+    RESERVED_DESCRIPTORS = 16 ///< Count of descriptors reserved for standard streams and logs
+};
+
+/**
+ * Ensures that limit of open descriptors allows to open given count of them.
+ *
+ * @param state a state of current process
+ * @param count a count of descriptors to open
+ * @return 0 if success
+ */
+int reserve_descriptors(ProcessState *state, rlim_t count);
+
+/**
+ * Closes descriptors of pipes not used by current process with one
+ * close_range() call per gap between kept descriptors, O(N) calls instead
+ * of O(N^2) closes. Works only if pipes occupy contiguous range of
+ * descriptors, which is true unless something was opened between pipes.
+ *
+ * @param state a state of current process, its pipes must be already chosen
+ * @param pipes_descriptors pipes descriptors
+ * @return 0 if success, non-zero if descriptors must be closed one by one
+ */
+int close_unused_range(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]);
+
+/**
+ * Closes all descriptors in range, both ends inclusive.
+ *
+ * @param first the first descriptor to close
+ * @param last the last descriptor to close
+ * @return 0 if success
+ */
+int close_descriptors(unsigned int first, unsigned int last);
 
-int init_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]) {
+/**
+ * Compares descriptors for qsort().
+ *
+ * @param a the first descriptor
+ * @param b the second descriptor
+ * @return negative, zero or positive if the first is less, equal or greater
+ */
+int compare_descriptors(const void *a, const void *b);
+
+int init_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]) {
     int i, j;
+    long total;
 
-    for (i = 0; i <= state->processes_count; ++i) {
-        for (j = 0; j <= state->processes_count; ++j) {
+    total = state->processes_count + 1;
+    if (reserve_descriptors(state, (rlim_t) (2 * total * (total - 1) + RESERVED_DESCRIPTORS))) {
+        return 1;
+    }
+
+    for (i = 0; i < total; ++i) {
+        for (j = 0; j < total; ++j) {
             if (i != j) {
                 if (pipe(&pipes_descriptors[i][j * 2]) == -1) {
                     log_pipe(state, "Failed to initialize pipe: from=%d to=%d error=%s\n", i, j, strerror(errno));
+                    while (i > 0 || j > 0) {
+                        if (--j < 0) {
+                            j = (int) total - 1;
+                            --i;
+                        }
+                        if (i != j) {
+                            close(pipes_descriptors[i][j * 2]);
+                            close(pipes_descriptors[i][j * 2 + 1]);
+                        }
+                    }
                     return 1;
                 }
                 log_pipe(state, "Create pipe: from=%d to=%d descriptors=[%d, %d]\n",
@@ -23,7 +92,34 @@ int init_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL
     return 0;
 }
 
-void close_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]) {
+int reserve_descriptors(ProcessState *state, rlim_t count) {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        log_pipe(state, "Failed to get descriptors limit: error=%s\n", strerror(errno));
+        return 1;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < count) {
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < count) {
+            log_pipe(state, "Too many descriptors for pipes: required=%lu limit=%lu\n",
+                     (unsigned long) count, (unsigned long) limit.rlim_max);
+            fprintf(stderr, "Too many descriptors for pipes: required=%lu limit=%lu\n",
+                    (unsigned long) count, (unsigned long) limit.rlim_max);
+            return 1;
+        }
+        limit.rlim_cur = count;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+            log_pipe(state, "Failed to raise descriptors limit: required=%lu error=%s\n",
+                     (unsigned long) count, strerror(errno));
+            return 1;
+        }
+        log_pipe(state, "Raise descriptors limit: limit=%lu\n", (unsigned long) count);
+    }
+
+    return 0;
+}
+
+void close_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]) {
     int i, j;
 
     for (i = 0; i <= state->processes_count; ++i) {
@@ -38,7 +134,7 @@ void close_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOT
     }
 }
 
-int prepare_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]) {
+int prepare_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]) {
     int i, j;
     local_id id;
     long processes_count;
@@ -49,11 +145,30 @@ int prepare_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TO
     for (i = 0; i <= processes_count; ++i) {
         if (i != id) {
             state->reading_pipes[i] = pipes_descriptors[i][id * 2];
+            state->writing_pipes[i] = pipes_descriptors[id][i * 2 + 1];
+            if (state->nonblocking && fcntl(state->reading_pipes[i], F_SETFL, O_NONBLOCK) == -1) {
+                log_pipe(state, "(%d) Failed to switch pipe to non-blocking mode: from=%d to=%d error=%s\n",
+                         id, i, id, strerror(errno));
+                return 1;
+            }
+            if (detector_timeout(state) >= 0 && fcntl(state->writing_pipes[i], F_SETFL, O_NONBLOCK) == -1) {
+                log_pipe(state, "(%d) Failed to switch pipe to non-blocking mode: from=%d to=%d error=%s\n",
+                         id, id, i, strerror(errno));
+                return 1;
+            }
+        }
+    }
+
+    if (!close_unused_range(state, pipes_descriptors)) {
+        return 0;
+    }
+
+    for (i = 0; i <= processes_count; ++i) {
+        if (i != id) {
             log_pipe(state, "(%d) Close unused pipe write endpoint: from=%d to=%d descriptor=%d\n",
                      id, i, id, pipes_descriptors[i][id * 2 + 1]);
             close(pipes_descriptors[i][id * 2 + 1]);
 
-            state->writing_pipes[i] = pipes_descriptors[id][i * 2 + 1];
             log_pipe(state, "(%d) Close unused pipe read endpoint: from=%d to=%d descriptor=%d\n",
                      id, id, i, pipes_descriptors[id][i * 2]);
             close(pipes_descriptors[id][i * 2]);
@@ -72,6 +187,79 @@ int prepare_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TO
     return 0;
 }
 
+int close_unused_range(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]) {
+    int *kept, first, last, i, j;
+    long total, count, kept_count, ranges;
+
+    total = state->processes_count + 1;
+    if (total < 2) {
+        return 0;
+    }
+    first = last = pipes_descriptors[0][2];
+    for (i = 0; i < total; ++i) {
+        for (j = 0; j < total * 2; ++j) {
+            if (i != j / 2) {
+                first = pipes_descriptors[i][j] < first ? pipes_descriptors[i][j] : first;
+                last = pipes_descriptors[i][j] > last ? pipes_descriptors[i][j] : last;
+            }
+        }
+    }
+    count = 2 * total * (total - 1);
+    if (last - first + 1 != count) {
+        return 1;
+    }
+
+    kept = malloc(sizeof(int) * 2 * (size_t) total);
+    if (!kept) {
+        return 1;
+    }
+    kept_count = ranges = 0;
+    for (i = 0; i < total; ++i) {
+        if (i != state->id) {
+            kept[kept_count++] = state->reading_pipes[i];
+            kept[kept_count++] = state->writing_pipes[i];
+        }
+    }
+    qsort(kept, (size_t) kept_count, sizeof(int), compare_descriptors);
+
+    for (i = 0; i <= kept_count; ++i) {
+        int from, to;
+
+        from = i ? kept[i - 1] + 1 : first;
+        to = i < kept_count ? kept[i] - 1 : last;
+        if (from > to) {
+            continue;
+        }
+        if (close_descriptors((unsigned int) from, (unsigned int) to)) {
+            log_pipe(state, "(%d) Failed to close range of descriptors: descriptors=[%d, %d] error=%s\n",
+                     state->id, from, to, strerror(errno));
+            free(kept);
+            return 1;
+        }
+        ++ranges;
+    }
+    log_pipe(state, "(%d) Close unused pipes: descriptors=[%d, %d] kept=%ld closed=%ld ranges=%ld\n",
+             state->id, first, last, kept_count, count - kept_count, ranges);
+
+    free(kept);
+    return 0;
+}
+
+int close_descriptors(unsigned int first, unsigned int last) {
+#ifdef SYS_close_range
+    return (int) syscall(SYS_close_range, first, last, 0);
+#else
+    (void) first;
+    (void) last;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int compare_descriptors(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
 void cleanup_pipes(ProcessState *state) {
     int i;
     local_id id;
@@ -89,3 +277,53 @@ void cleanup_pipes(ProcessState *state) {
         }
     }
 }
+
+int write_pipe(ProcessState *state, local_id to, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written;
+
+        count_write(state);
+        written = writev(state->writing_pipes[to], iov, count);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd fd;
+
+                if (flush_batches(state)) {
+                    return 1;
+                }
+                fd.fd = state->writing_pipes[to];
+                fd.events = POLLOUT;
+                count_poll(state);
+                if (poll(&fd, 1, wait_slice(state, -1)) < 0 && errno != EINTR) {
+                    fprintf(stderr, "(%d) Failed to poll pipe: descriptor=%d error=%s\n",
+                            state->id, fd.fd, strerror(errno));
+                    return 1;
+                }
+                heartbeat(state);
+                if (peer_failed(state, to)) {
+                    fprintf(stderr, "(%d) Peer is dead: peer=%d\n", state->id, to);
+                    state->dead[to] = 1;
+                    return 1;
+                }
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "(%d) Failed to send message to=%d (descriptor=%d) error=%s\n",
+                    state->id, to, state->writing_pipes[to], strerror(errno));
+            return 1;
+        }
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
@@ -1,3 +1,4 @@
+#include <sys/uio.h>
 #include "distributed.h"
 #include "core.h"
 
@@ -7,13 +8,15 @@
 /**
  * Initialize pipes descriptors. In position pipes_descriptors[i][j * 2] read
  * endpoint of pipe between i and j process and write endpoint in position
- * pipes_descriptors[i][j * 2 + 1].
+ * pipes_descriptors[i][j * 2 + 1]. Raises soft limit of open descriptors if
+ * the mesh doesn't fit into it and fails without leaking descriptors if
+ * the hard limit is not enough either.
  *
  * @param processes_count a count of child processes
  * @param pipes_descriptors matrix for pipes descriptors
  * @return 0 if success
  */
-int init_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]);
+int init_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]);
 
 /**
  * Closes all opened pipes descriptors.
@@ -21,16 +24,18 @@ int init_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL
  * @param processes_count a count of child processes
  * @param pipes_descriptors matrix of pipes descriptors
  */
-void close_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]);
+void close_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]);
 
 /**
  * Initializes process info reading and writing pipes descriptors and closes unused.
+ * Unused descriptors are closed by ranges with close_range() if the kernel
+ * supports it and one by one otherwise.
  *
  * @param state a state of current process
  * @param pipes_descriptors pipes descriptors
  * @return 0 if success
  */
-int prepare_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TOTAL_PROCESSES * 2]);
+int prepare_pipes(ProcessState *state, int pipes_descriptors[][(state->processes_count + 1) * 2]);
 
 /**
  * Closes all opened pipes descriptors for child process.
@@ -39,4 +44,21 @@ int prepare_pipes(ProcessState *state, int pipes_descriptors[TOTAL_PROCESSES][TO
  */
 void cleanup_pipes(ProcessState *state);
 
+/**
+ * Writes all bytes of vector to the pipe between current process and
+ * destination, resuming after partial writes. Vector is modified. Flushes
+ * batches of other destinations before waiting for non-blocking channel, so
+ * frames buffered for them don't wait while current process is stuck.
+ * Write endpoints are non-blocking if failure detector timeout is set, so
+ * blocked process keeps publishing its heartbeat and fails once destination
+ * is dead.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param iov vector of buffers to write
+ * @param count count of buffers in vector
+ * @return 0 if success
+ */
+int write_pipe(ProcessState *state, local_id to, struct iovec *iov, int count);
+
 #endif //PA1_PIPES_H
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+/**
+ * Header placed before every block of pool.
+ */
+typedef union PoolBlock {
+    union PoolBlock *next;       ///< Next free block of the same size class
+    size_t           size_class; ///< Size class of acquired block
+    long long        alignment;  ///< Aligns data of block
+} PoolBlock;
+
+/**
+ * Sizes of blocks by size class. The last class fits any message.
+ */
+static const size_t pool_class_sizes[POOL_CLASSES_COUNT] = {64, 256, 1024, MAX_MESSAGE_LEN};
+
+void *pool_acquire(ProcessState *state, size_t size) {
+    MessagePool *pool;
+    PoolBlock *block;
+    int size_class;
+
+    pool = &state->pool;
+    size_class = 0;
+    while (size_class < POOL_CLASSES_COUNT && pool_class_sizes[size_class] < size) {
+        ++size_class;
+    }
+    if (size_class == POOL_CLASSES_COUNT) {
+        fprintf(stderr, "(%d) Block is too large for pool: size=%zu\n", state->id, size);
+        return NULL;
+    }
+
+    block = pool->blocks[size_class];
+    if (block) {
+        pool->blocks[size_class] = block->next;
+        --pool->counts[size_class];
+    } else if (!(block = malloc(sizeof(PoolBlock) + pool_class_sizes[size_class]))) {
+        fprintf(stderr, "(%d) Failed to allocate block: size=%zu\n", state->id, pool_class_sizes[size_class]);
+        return NULL;
+    }
+    block->size_class = (size_t) size_class;
+
+    return block + 1;
+}
+
+void pool_release(ProcessState *state, void *data) {
+    MessagePool *pool;
+    PoolBlock *block;
+    size_t size_class;
+
+    if (!data) {
+        return;
+    }
+
+    pool = &state->pool;
+    block = (PoolBlock *) data - 1;
+    size_class = block->size_class;
+    if (pool->counts[size_class] >= POOL_CLASS_LIMIT) {
+        free(block);
+        return;
+    }
+
+    block->next = pool->blocks[size_class];
+    pool->blocks[size_class] = block;
+    ++pool->counts[size_class];
+}
+
+Message *acquire_message(ProcessState *state, size_t payload_len) {
+    return pool_acquire(state, sizeof(MessageHeader) + payload_len);
+}
+
+void release_message(ProcessState *state, Message *message) {
+    pool_release(state, message);
+}
+
+void release_pool(ProcessState *state) {
+    int size_class;
+
+    for (size_class = 0; size_class < POOL_CLASSES_COUNT; ++size_class) {
+        while (state->pool.blocks[size_class]) {
+            PoolBlock *block;
+
+            block = state->pool.blocks[size_class];
+            state->pool.blocks[size_class] = block->next;
+            free(block);
+        }
+        state->pool.counts[size_class] = 0;
+    }
+}
@@ -0,0 +1,56 @@
+#include <stddef.h>
+#include "core.h"
+
+#ifndef PA1_POOL_H
+#define PA1_POOL_H
+
+enum {
+    POOL_CLASS_LIMIT = 256 ///< Maximum count of free blocks kept in single size class
+};
+
+/**
+ * Acquires block of at least given size from pool of current process. The
+ * allocator is called only when free list of size class is empty.
+ *
+ * @param state a state of current process
+ * @param size required size in bytes, at most MAX_MESSAGE_LEN
+ * @return acquired block, NULL on error
+ */
+void *pool_acquire(ProcessState *state, size_t size);
+
+/**
+ * Returns block to pool of current process. Block may be acquired by other
+ * process of the same address space, so threads can pass blocks to each
+ * other. Blocks above POOL_CLASS_LIMIT are returned to the allocator.
+ *
+ * @param state a state of current process
+ * @param block block returned by pool_acquire(), may be NULL
+ */
+void pool_release(ProcessState *state, void *block);
+
+/**
+ * Acquires message with room only for header and payload of given length.
+ * Bytes after s_payload[payload_len - 1] must not be touched.
+ *
+ * @param state a state of current process
+ * @param payload_len length of payload, at most MAX_PAYLOAD_LEN
+ * @return acquired message, NULL on error
+ */
+Message *acquire_message(ProcessState *state, size_t payload_len);
+
+/**
+ * Returns message to pool of current process.
+ *
+ * @param state a state of current process
+ * @param message message returned by acquire_message(), may be NULL
+ */
+void release_message(ProcessState *state, Message *message);
+
+/**
+ * Returns all free blocks of current process to the allocator.
+ *
+ * @param state a state of current process
+ */
+void release_pool(ProcessState *state);
+
+#endif //PA1_POOL_H
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+#include "queues.h"
+#include "shm.h"
+#include "pool.h"
+
+int enqueue_frame(ProcessState *state, local_id to, const unsigned char *header,
+                  const char *payload, size_t payload_len) {
+    unsigned char *frame;
+
+    frame = pool_acquire(state, sizeof(MessageHeader) + payload_len);
+    if (!frame) {
+        fprintf(stderr, "(%d) Failed to acquire frame: to=%d length=%zu\n", state->id, to, payload_len);
+        return 1;
+    }
+    memcpy(frame, header, sizeof(MessageHeader));
+    memcpy(frame + sizeof(MessageHeader), payload, payload_len);
+
+    return shm_write(state, to, &frame, sizeof(frame));
+}
+
+const unsigned char *dequeue_frame(ProcessState *state, local_id from) {
+    unsigned char *frame;
+
+    if (shm_read(state, from, &frame, sizeof(frame))) {
+        return NULL;
+    }
+    return frame;
+}
+
+void release_frame(ProcessState *state, const unsigned char *frame) {
+    pool_release(state, (void *) frame);
+}
+
+void cleanup_queues(ProcessState *state) {
+    long from, to;
+
+    if (!state->shm) {
+        return;
+    }
+
+    for (from = 0; from <= state->processes_count; ++from) {
+        for (to = 0; to <= state->processes_count; ++to) {
+            ShmRing *ring;
+            unsigned char *frame;
+
+            ring = shm_ring(state->shm, (local_id) from, (local_id) to);
+            while (ring_available(ring) >= sizeof(frame)) {
+                ring_read(ring, NULL, -1, &frame, sizeof(frame));
+                pool_release(state, frame);
+            }
+        }
+    }
+    release_pool(state);
+    cleanup_shm(state);
+}
@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include "core.h"
+
+#ifndef PA1_QUEUES_H
+#define PA1_QUEUES_H
+
+/**
+ * Enqueues frame of serialized header and payload to the queue between
+ * current thread and destination. Frame is copied once to block of message
+ * pool and only its pointer is written to the ring, so the receiver takes it
+ * over without copying through the ring. Blocks while queue is full.
+ *
+ * @param state a state of current thread
+ * @param to destination thread identifier
+ * @param header serialized message header
+ * @param payload message payload
+ * @param payload_len length of payload
+ * @return 0 if success
+ */
+int enqueue_frame(ProcessState *state, local_id to, const unsigned char *header,
+                  const char *payload, size_t payload_len);
+
+/**
+ * Dequeues frame from the queue between source and current thread. Blocks
+ * while queue is empty. Frame must be released with release_frame().
+ *
+ * @param state a state of current thread
+ * @param from source thread identifier
+ * @return frame of serialized header and payload, NULL on error
+ */
+const unsigned char *dequeue_frame(ProcessState *state, local_id from);
+
+/**
+ * Releases frame returned by dequeue_frame() to pool of current thread, so
+ * frames migrate between pools of threads instead of going through the
+ * allocator.
+ *
+ * @param state a state of current thread
+ * @param frame frame to release
+ */
+void release_frame(ProcessState *state, const unsigned char *frame);
+
+/**
+ * Releases frames that were never received and unmaps queues. Must be
+ * called by parent after all threads are joined.
+ *
+ * @param state a state of parent thread
+ */
+void cleanup_queues(ProcessState *state);
+
+#endif //PA1_QUEUES_H
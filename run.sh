@@ -2,5 +2,5 @@ rm events.log
 rm pipes.log
 rm a.out
 
-clang-3.5 -std=c99 -Wall -pedantic *.c
+clang-3.5 -std=c99 -Wall -pedantic -pthread *.c
 ./a.out -p $1
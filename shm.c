@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "shm.h"
+#include "detector.h"
+
+#ifdef SYS_futex
+#include <linux/futex.h>
+#endif
+
+/**
+ * Header of shared memory region. Doorbells are placed right after header
+ * and rings right after doorbells.
+ */
+struct ShmRegion {
+    size_t size;            ///< Size of mapped region in bytes
+    size_t capacity;        ///< Capacity of every ring in bytes
+    long   processes_count; ///< Total count of processes excluding parent
+};
+
+/**
+ * Sleeps until doorbell sequence differs from the given one or timeout.
+ *
+ * @param doorbell doorbell to sleep on, NULL to sleep for timeout
+ * @param sequence sequence read before the last check of ring
+ * @param timeout time to sleep in milliseconds
+ */
+void shm_sleep(ShmDoorbell *doorbell, uint32_t sequence, int timeout);
+
+int init_shm(ProcessState *state) {
+    size_t rings_count, capacity, size, i;
+    struct ShmRegion *region;
+
+    rings_count = (size_t) (state->processes_count + 1) * (state->processes_count + 1);
+    capacity = SHM_RING_CAPACITY;
+    while (capacity > SHM_MIN_CAPACITY && rings_count * capacity > SHM_RINGS_LIMIT) {
+        capacity >>= 1;
+    }
+    size = CACHE_LINE_SIZE + (size_t) (state->processes_count + 1) * sizeof(ShmDoorbell)
+           + rings_count * (sizeof(ShmRing) + capacity);
+
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        log_pipe(state, "Failed to map shared memory: size=%zu error=%s\n", size, strerror(errno));
+        return 1;
+    }
+    log_pipe(state, "Map shared memory: rings=%zu capacity=%zu size=%zu\n", rings_count, capacity, size);
+
+    region->size = size;
+    region->capacity = capacity;
+    region->processes_count = state->processes_count;
+    for (i = 0; i < rings_count; ++i) {
+        shm_ring(region, (local_id) (i / (size_t) (state->processes_count + 1)),
+                 (local_id) (i % (size_t) (state->processes_count + 1)))->capacity = capacity;
+    }
+    state->shm = region;
+
+    return 0;
+}
+
+void cleanup_shm(ProcessState *state) {
+    if (state->shm) {
+        log_pipe(state, "(%d) Unmap shared memory: size=%zu\n", state->id, state->shm->size);
+        munmap(state->shm, state->shm->size);
+        state->shm = NULL;
+    }
+}
+
+int shm_write(ProcessState *state, local_id to, const void *buffer, size_t size) {
+    if (ring_write(shm_ring(state->shm, state->id, to), state, to, buffer, size)) {
+        fprintf(stderr, "(%d) Peer is dead before ring was drained: peer=%d\n", state->id, to);
+        state->dead[to] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int shm_read(ProcessState *state, local_id from, void *buffer, size_t size) {
+    if (ring_read(shm_ring(state->shm, from, state->id), state, from, buffer, size)) {
+        fprintf(stderr, "(%d) Peer is dead before message was written: peer=%d\n", state->id, from);
+        state->dead[from] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+size_t shm_available(ProcessState *state, local_id from) {
+    return ring_available(shm_ring(state->shm, from, state->id));
+}
+
+int ring_write(ShmRing *ring, ProcessState *state, local_id peer, const void *buffer, size_t size) {
+    const unsigned char *bytes;
+    size_t head, capacity;
+    ShmBackoff backoff;
+
+    bytes = buffer;
+    head = ring->head;
+    capacity = ring->capacity;
+    memset(&backoff, 0, sizeof(backoff));
+
+    while (size > 0) {
+        size_t tail, chunk, offset, first;
+
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        chunk = capacity - (head - tail);
+        if (!chunk) {
+            if (shm_backoff(state, peer, -1, &backoff)) {
+                shm_settle(state, &backoff);
+                return 1;
+            }
+            continue;
+        }
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        offset = head & (capacity - 1);
+        first = capacity - offset < chunk ? capacity - offset : chunk;
+        memcpy(&ring->data[offset], bytes, first);
+        memcpy(ring->data, bytes + first, chunk - first);
+
+        head += chunk;
+        bytes += chunk;
+        size -= chunk;
+        shm_settle(state, &backoff);
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        shm_notify(state, peer);
+    }
+
+    return 0;
+}
+
+int ring_read(ShmRing *ring, ProcessState *state, local_id peer, void *buffer, size_t size) {
+    unsigned char *bytes;
+    size_t tail, capacity;
+    ShmBackoff backoff;
+
+    bytes = buffer;
+    tail = ring->tail;
+    capacity = ring->capacity;
+    memset(&backoff, 0, sizeof(backoff));
+
+    while (size > 0) {
+        size_t head, chunk, offset, first;
+
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        chunk = head - tail;
+        if (!chunk) {
+            if (shm_backoff(state, peer, -1, &backoff) && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+                shm_settle(state, &backoff);
+                return 1;
+            }
+            continue;
+        }
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        offset = tail & (capacity - 1);
+        first = capacity - offset < chunk ? capacity - offset : chunk;
+        memcpy(bytes, &ring->data[offset], first);
+        memcpy(bytes + first, ring->data, chunk - first);
+
+        tail += chunk;
+        bytes += chunk;
+        size -= chunk;
+        shm_settle(state, &backoff);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        shm_notify(state, peer);
+    }
+
+    return 0;
+}
+
+size_t ring_available(ShmRing *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+local_id shm_wait_any(ProcessState *state, const char *pending, int timeout) {
+    long total, i;
+    long long deadline;
+    ShmBackoff backoff;
+
+    total = state->processes_count + 1;
+    deadline = timeout > 0 ? monotonic_ns() + timeout * 1000000LL : -1;
+    memset(&backoff, 0, sizeof(backoff));
+
+    for (;;) {
+        for (i = 1; i <= total; ++i) {
+            local_id id = (local_id) ((state->last_from + i) % total);
+
+            if (pending[id] && shm_available(state, id)) {
+                shm_settle(state, &backoff);
+                return id;
+            }
+        }
+        if (!timeout) {
+            return -1;
+        }
+        shm_backoff(state, -1, deadline, &backoff);
+        if (!backoff.spins && ((deadline >= 0 && monotonic_ns() >= deadline) || failed_peer(state, pending) >= 0)) {
+            shm_settle(state, &backoff);
+            return -1;
+        }
+    }
+}
+
+ShmRing *shm_ring(struct ShmRegion *region, local_id from, local_id to) {
+    char *rings;
+
+    rings = (char *) region + CACHE_LINE_SIZE + (size_t) (region->processes_count + 1) * sizeof(ShmDoorbell);
+    return (ShmRing *) (rings + (size_t) (from * (region->processes_count + 1) + to)
+                                * (sizeof(ShmRing) + region->capacity));
+}
+
+ShmDoorbell *shm_doorbell(struct ShmRegion *region, local_id id) {
+    ShmDoorbell *doorbells;
+
+    doorbells = (ShmDoorbell *) ((char *) region + CACHE_LINE_SIZE);
+    return &doorbells[id];
+}
+
+int shm_backoff(ProcessState *state, local_id peer, long long deadline, ShmBackoff *backoff) {
+    ShmDoorbell *doorbell;
+    int timeout;
+
+    if (++backoff->spins < SHM_SPIN_LIMIT) {
+        return 0;
+    }
+    backoff->spins = 0;
+    doorbell = state && state->shm ? shm_doorbell(state->shm, state->id) : NULL;
+
+    if (backoff->yields < SHM_YIELD_LIMIT) {
+        ++backoff->yields;
+        sched_yield();
+    } else if (doorbell && !backoff->armed) {
+        __atomic_store_n(&doorbell->sleeping, 1, __ATOMIC_SEQ_CST);
+        backoff->sequence = __atomic_load_n(&doorbell->sequence, __ATOMIC_SEQ_CST);
+        backoff->armed = 1;
+        return 0;
+    } else {
+        timeout = state ? wait_slice(state, deadline) : -1;
+        if (timeout < 0 || timeout > SHM_SLEEP_LIMIT) {
+            timeout = SHM_SLEEP_LIMIT;
+        }
+        shm_sleep(doorbell, backoff->sequence, timeout);
+        backoff->armed = 0;
+    }
+
+    if (!state) {
+        return 0;
+    }
+    heartbeat(state);
+    return peer >= 0 && peer_failed(state, peer);
+}
+
+void shm_settle(ProcessState *state, ShmBackoff *backoff) {
+    if (backoff->yields >= SHM_YIELD_LIMIT && state && state->shm) {
+        __atomic_store_n(&shm_doorbell(state->shm, state->id)->sleeping, 0, __ATOMIC_RELAXED);
+    }
+    memset(backoff, 0, sizeof(*backoff));
+}
+
+void shm_notify(ProcessState *state, local_id peer) {
+    ShmDoorbell *doorbell;
+
+    if (!state || !state->shm || peer < 0) {
+        return;
+    }
+    doorbell = shm_doorbell(state->shm, peer);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&doorbell->sleeping, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&doorbell->sequence, 1, __ATOMIC_SEQ_CST);
+#ifdef SYS_futex
+        syscall(SYS_futex, &doorbell->sequence, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+void shm_sleep(ShmDoorbell *doorbell, uint32_t sequence, int timeout) {
+    struct timespec pause;
+
+    pause.tv_sec = timeout / 1000;
+    pause.tv_nsec = (long) (timeout % 1000) * 1000000L;
+#ifdef SYS_futex
+    if (doorbell) {
+        syscall(SYS_futex, &doorbell->sequence, FUTEX_WAIT, sequence, &pause, NULL, 0);
+        return;
+    }
+#else
+    (void) doorbell;
+    (void) sequence;
+#endif
+    nanosleep(&pause, NULL);
+}
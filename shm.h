@@ -0,0 +1,207 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+#ifndef PA1_SHM_H
+#define PA1_SHM_H
+
+enum {
+    SHM_RING_CAPACITY = 1 << 14, ///< Maximal capacity of single ring in bytes, must be power of two
+    SHM_MIN_CAPACITY = 1 << 11,  ///< Minimal capacity of single ring in bytes, must be power of two
+    SHM_RINGS_LIMIT = 1 << 25,   ///< Total capacity of rings above which capacity of ring is reduced
+    SHM_SPIN_LIMIT = 64,         ///< Count of busy spins before process yields CPU
+    SHM_YIELD_LIMIT = 16,        ///< Count of yields before process sleeps
+    SHM_SLEEP_LIMIT = 10,        ///< The longest sleep in milliseconds before peer is checked
+    CACHE_LINE_SIZE = 64         ///< Size of cache line in bytes
+};
+
+/**
+ * Single-producer/single-consumer ring in shared memory. Head is modified
+ * only by producer and tail only by consumer, so both are placed on separate
+ * cache lines.
+ */
+typedef struct {
+    size_t        head;                                            ///< Total count of written bytes
+    size_t        capacity;                                        ///< Capacity in bytes, power of two
+    char          head_padding[CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+    size_t        tail;                                            ///< Total count of read bytes
+    char          tail_padding[CACHE_LINE_SIZE - sizeof(size_t)];
+    unsigned char data[];                                          ///< Ring data of capacity bytes
+} ShmRing;
+
+/**
+ * Doorbell of process that sleeps on futex after spinning and yielding for a
+ * while. Peer that moves head or tail of ring of sleeping process bumps the
+ * sequence and wakes it up.
+ */
+typedef struct {
+    uint32_t sequence;                                  ///< Counter of wakeups, futex word
+    uint32_t sleeping;                                  ///< Non-zero while process is going to sleep
+    char     padding[CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
+} ShmDoorbell;
+
+/**
+ * Progress of process waiting for the other side of ring.
+ */
+typedef struct {
+    int      spins;    ///< Count of busy spins since the last yield
+    int      yields;   ///< Count of yields since the last progress
+    int      armed;    ///< Non-zero if sequence was read after sleeping flag was set
+    uint32_t sequence; ///< Sequence of doorbell to sleep on
+} ShmBackoff;
+
+/**
+ * Maps shared memory region with single-producer/single-consumer ring for
+ * every ordered pair of processes and doorbell for every process. Capacity of
+ * rings is halved while their total capacity is above SHM_RINGS_LIMIT, so
+ * region doesn't grow quadratically with count of processes. Must be called
+ * before fork.
+ *
+ * @param state a state of current process
+ * @return 0 if success
+ */
+int init_shm(ProcessState *state);
+
+/**
+ * Unmaps shared memory region of current process.
+ *
+ * @param state a state of current process
+ */
+void cleanup_shm(ProcessState *state);
+
+/**
+ * Writes bytes to the ring between current process and destination. Blocks
+ * while ring is full and destination is alive.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param buffer bytes to write
+ * @param size count of bytes to write
+ * @return 0 if success
+ */
+int shm_write(ProcessState *state, local_id to, const void *buffer, size_t size);
+
+/**
+ * Reads exactly size bytes from the ring between source and current process.
+ * Blocks while ring is empty and source is alive, so receive from process
+ * that has exited fails even without failure detector timeout.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param buffer buffer for read bytes
+ * @param size count of bytes to read
+ * @return 0 if success
+ */
+int shm_read(ProcessState *state, local_id from, void *buffer, size_t size);
+
+/**
+ * Returns count of bytes available for reading in the ring between source and
+ * current process. Never blocks.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @return count of available bytes
+ */
+size_t shm_available(ProcessState *state, local_id from);
+
+/**
+ * Waits until one of rings from pending processes is not empty. Rings are
+ * scanned starting after the last sender, so no process can starve others.
+ * Returns on timeout also if one of pending processes has failed.
+ *
+ * @param state a state of current process
+ * @param pending flags indexed by process identifier, non-zero for processes to wait for
+ * @param timeout time to wait in milliseconds, negative to wait forever
+ * @return identifier of process with non-empty ring or -1 on timeout
+ */
+local_id shm_wait_any(ProcessState *state, const char *pending, int timeout);
+
+/**
+ * Returns ring between two processes.
+ *
+ * @param region shared memory region
+ * @param from producer process identifier
+ * @param to consumer process identifier
+ * @return ring
+ */
+ShmRing *shm_ring(struct ShmRegion *region, local_id from, local_id to);
+
+/**
+ * Returns doorbell of process.
+ *
+ * @param region shared memory region
+ * @param id process identifier
+ * @return doorbell
+ */
+ShmDoorbell *shm_doorbell(struct ShmRegion *region, local_id id);
+
+/**
+ * Writes bytes to the ring. Blocks while ring is full.
+ *
+ * @param ring ring to write to, current process must be its only producer
+ * @param state a state of current process publishing heartbeats while blocked, NULL if it has none
+ * @param peer consumer of ring in region of state that fails write after its failure and is woken up
+ *             after every written chunk, -1 if it's not tracked
+ * @param buffer bytes to write
+ * @param size count of bytes to write
+ * @return 0 if success, non-zero if peer has failed
+ */
+int ring_write(ShmRing *ring, ProcessState *state, local_id peer, const void *buffer, size_t size);
+
+/**
+ * Reads exactly size bytes from the ring. Blocks while ring is empty.
+ *
+ * @param ring ring to read from, current process must be its only consumer
+ * @param state a state of current process publishing heartbeats while blocked, NULL if it has none
+ * @param peer producer of ring in region of state that fails read after its failure and is woken up
+ *             after every read chunk, -1 if it's not tracked
+ * @param buffer buffer for read bytes
+ * @param size count of bytes to read
+ * @return 0 if success, non-zero if peer has failed before all bytes were written
+ */
+int ring_read(ShmRing *ring, ProcessState *state, local_id peer, void *buffer, size_t size);
+
+/**
+ * Returns count of bytes available for reading in the ring. Never blocks.
+ *
+ * @param ring ring to check, current process must be its only consumer
+ * @return count of available bytes
+ */
+size_t ring_available(ShmRing *ring);
+
+/**
+ * Waits for the other side of ring: spins for a while, then yields CPU and
+ * at last sleeps on doorbell of current process. Sleeping flag is set and
+ * sequence is read one call before the sleep, so the caller checks ring
+ * once more in between and never misses a wakeup. Sleep is limited by
+ * SHM_SLEEP_LIMIT and the next heartbeat. Heartbeat is published and peer is
+ * checked only when CPU is given up. Process without doorbell sleeps without
+ * wakeups.
+ *
+ * @param state a state of current process, NULL if it has no doorbell and heartbeats
+ * @param peer process on the other side of ring, -1 if it's not tracked
+ * @param deadline value of monotonic_ns() to wake up at, negative if none
+ * @param backoff progress of waiting, zero before the first call
+ * @return non-zero if peer has failed
+ */
+int shm_backoff(ProcessState *state, local_id peer, long long deadline, ShmBackoff *backoff);
+
+/**
+ * Finishes waiting after progress: clears sleeping flag if it was set and
+ * resets backoff.
+ *
+ * @param state a state of current process, NULL if it has no doorbell
+ * @param backoff progress of waiting
+ */
+void shm_settle(ProcessState *state, ShmBackoff *backoff);
+
+/**
+ * Wakes up peer if it sleeps on its doorbell. Must be called after head or
+ * tail of ring shared with peer is moved.
+ *
+ * @param state a state of current process, NULL if ring is not in its region
+ * @param peer process on the other side of ring, -1 if it's not tracked
+ */
+void shm_notify(ProcessState *state, local_id peer);
+
+#endif //PA1_SHM_H
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "sockets.h"
+
+int open_socket_pair(int descriptors[2], int packets) {
+    return socketpair(AF_UNIX, packets ? SOCK_SEQPACKET : SOCK_STREAM, 0, descriptors) == -1;
+}
+
+int send_descriptor_tagged(int socket, int8_t tag, int descriptor) {
+    struct msghdr message;
+    struct iovec iov;
+    struct cmsghdr *header;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    iov.iov_base = &tag;
+    iov.iov_len = sizeof(tag);
+    memset(&message, 0, sizeof(message));
+    memset(control, 0, sizeof(control));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (descriptor >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+    }
+
+    while (sendmsg(socket, &message, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int receive_descriptor_tagged(int socket, int8_t *tag, int *descriptor) {
+    struct msghdr message;
+    struct iovec iov;
+    struct cmsghdr *header;
+    char control[CMSG_SPACE(sizeof(int))];
+    ssize_t received;
+
+    iov.iov_base = tag;
+    iov.iov_len = sizeof(*tag);
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    do {
+        received = recvmsg(socket, &message, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) {
+        return received < 0 ? -1 : 0;
+    }
+
+    header = CMSG_FIRSTHDR(&message);
+    if (!header) {
+        *descriptor = -1;
+        return 1;
+    }
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+        errno = EBADMSG;
+        return -1;
+    }
+    memcpy(descriptor, CMSG_DATA(header), sizeof(int));
+
+    return 1;
+}
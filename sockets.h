@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#ifndef PA1_SOCKETS_H
+#define PA1_SOCKETS_H
+
+/*
+ * Wrappers of socket API. They live in separate translation unit because
+ * <sys/socket.h> declares send() that conflicts with send() from ipc.h.
+ */
+
+/**
+ * Creates pair of connected local sockets.
+ *
+ * @param descriptors array for descriptors of both ends
+ * @param packets non-zero for sequential packets socket, zero for stream socket
+ * @return 0 if success
+ */
+int open_socket_pair(int descriptors[2], int packets);
+
+/**
+ * Sends descriptor tagged with process identifier over local socket.
+ *
+ * @param socket descriptor of local socket
+ * @param tag identifier of process sent with descriptor
+ * @param descriptor descriptor to send, negative to send only tag
+ * @return 0 if success
+ */
+int send_descriptor_tagged(int socket, int8_t tag, int descriptor);
+
+/**
+ * Receives descriptor tagged with process identifier from local socket.
+ *
+ * @param socket descriptor of local socket
+ * @param tag received identifier of process
+ * @param descriptor received descriptor, -1 if only tag is received
+ * @return 1 if descriptor is received, 0 if socket is closed, negative on error
+ */
+int receive_descriptor_tagged(int socket, int8_t *tag, int *descriptor);
+
+#endif //PA1_SOCKETS_H
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "stream.h"
+#include "distributed.h"
+
+int open_stream(ProcessState *state, Stream *stream, local_id to, int16_t type, size_t size) {
+    MessageHeader header;
+    char payload[STREAM_OPEN_LEN];
+    uint64_t value;
+    int i;
+
+    value = size;
+    for (i = 0; i < STREAM_OPEN_LEN; ++i) {
+        payload[i] = (char) (value >> (8 * i));
+    }
+    header.s_magic = MESSAGE_MAGIC;
+    header.s_type = type;
+    header.s_payload_len = STREAM_OPEN_LEN;
+    header.s_local_time = 0;
+
+    stream->peer = to;
+    stream->type = type;
+    stream->size = size;
+    stream->offset = 0;
+
+    if (send_payload(state, to, &header, payload)) {
+        fprintf(stderr, "(%d) Failed to open stream: to=%d size=%zu\n", state->id, to, size);
+        return 1;
+    }
+    return 0;
+}
+
+int send_fragment(ProcessState *state, Stream *stream, const char *data) {
+    MessageHeader header;
+    size_t length;
+
+    length = stream->size - stream->offset;
+    if (length > MAX_PAYLOAD_LEN) {
+        length = MAX_PAYLOAD_LEN;
+    }
+    if (!length) {
+        fprintf(stderr, "(%d) Stream is already sent: to=%d size=%zu\n", state->id, stream->peer, stream->size);
+        return 1;
+    }
+    header.s_magic = MESSAGE_MAGIC;
+    header.s_type = stream->type;
+    header.s_payload_len = (uint16_t) length;
+    header.s_local_time = 0;
+
+    if (send_payload(state, stream->peer, &header, &data[stream->offset])) {
+        fprintf(stderr, "(%d) Failed to send fragment: to=%d offset=%zu\n", state->id, stream->peer, stream->offset);
+        return 2;
+    }
+    stream->offset += length;
+    return 0;
+}
+
+int accept_stream(ProcessState *state, Stream *stream, local_id from, int16_t type) {
+    Message msg;
+    uint64_t value;
+    int i;
+
+    if (receive(state, from, &msg)) {
+        fprintf(stderr, "(%d) Failed to receive opening of stream: from=%d\n", state->id, from);
+        return 1;
+    }
+    if (msg.s_header.s_type != type || msg.s_header.s_payload_len != STREAM_OPEN_LEN) {
+        fprintf(stderr, "(%d) Message doesn't open stream: from=%d type=%d length=%d\n",
+                state->id, from, msg.s_header.s_type, msg.s_header.s_payload_len);
+        return 2;
+    }
+    value = 0;
+    for (i = STREAM_OPEN_LEN - 1; i >= 0; --i) {
+        value = value << 8 | (unsigned char) msg.s_payload[i];
+    }
+    if (value > SIZE_MAX) {
+        fprintf(stderr, "(%d) Stream is too large: from=%d size=%llu\n",
+                state->id, from, (unsigned long long) value);
+        return 3;
+    }
+
+    stream->peer = from;
+    stream->type = type;
+    stream->size = (size_t) value;
+    stream->offset = 0;
+    return 0;
+}
+
+int receive_fragment(ProcessState *state, Stream *stream, char *data) {
+    Message local, *msg;
+    char saved[sizeof(MessageHeader)];
+    size_t expected;
+    int in_place, result;
+
+    expected = stream->size - stream->offset;
+    in_place = stream->offset >= sizeof(MessageHeader) && expected >= MAX_PAYLOAD_LEN;
+    if (expected > MAX_PAYLOAD_LEN) {
+        expected = MAX_PAYLOAD_LEN;
+    }
+    if (!expected) {
+        fprintf(stderr, "(%d) Stream is already received: from=%d size=%zu\n",
+                state->id, stream->peer, stream->size);
+        return 1;
+    }
+
+    msg = &local;
+    if (in_place) {
+        msg = (Message *) &data[stream->offset - sizeof(MessageHeader)];
+        memcpy(saved, msg, sizeof(saved));
+    }
+    result = receive(state, stream->peer, msg);
+    local.s_header = msg->s_header;
+    if (in_place) {
+        memcpy(msg, saved, sizeof(saved));
+    }
+
+    if (result) {
+        fprintf(stderr, "(%d) Failed to receive fragment: from=%d offset=%zu\n",
+                state->id, stream->peer, stream->offset);
+        return 2;
+    }
+    if (local.s_header.s_type != stream->type || local.s_header.s_payload_len != expected) {
+        fprintf(stderr, "(%d) Fragment has incorrect type or length: from=%d type=%d length=%d offset=%zu\n",
+                state->id, stream->peer, local.s_header.s_type, local.s_header.s_payload_len, stream->offset);
+        return 3;
+    }
+    if (!in_place) {
+        memcpy(&data[stream->offset], local.s_payload, expected);
+    }
+    stream->offset += expected;
+    return 0;
+}
+
+int send_stream(ProcessState *state, local_id to, int16_t type, const char *data, size_t size) {
+    Stream stream;
+
+    if (open_stream(state, &stream, to, type, size)) {
+        return 1;
+    }
+    while (stream.offset < stream.size) {
+        if (send_fragment(state, &stream, data)) {
+            return 2;
+        }
+    }
+    return 0;
+}
+
+int receive_stream(ProcessState *state, local_id from, int16_t type, char *data, size_t capacity, size_t *size) {
+    Stream stream;
+
+    if (accept_stream(state, &stream, from, type)) {
+        return 1;
+    }
+    if (stream.size > capacity) {
+        fprintf(stderr, "(%d) Stream doesn't fit into buffer: from=%d size=%zu capacity=%zu\n",
+                state->id, from, stream.size, capacity);
+        return 2;
+    }
+    while (stream.offset < stream.size) {
+        if (receive_fragment(state, &stream, data)) {
+            return 3;
+        }
+    }
+    *size = stream.size;
+    return 0;
+}
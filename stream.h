@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include "core.h"
+
+#ifndef PA1_STREAM_H
+#define PA1_STREAM_H
+
+/*
+ * Stream transfers buffer of any size as consecutive messages of the same
+ * type: opening message with total size of data as 8-byte little-endian
+ * integer and fragments of MAX_PAYLOAD_LEN bytes except the last one. Every
+ * fragment is sent and received by send() and receive(), so stream works
+ * over all transports and is compressed with -z. Receiver consumes fragments
+ * as they arrive, while sender keeps writing the next ones.
+ *
+ * Fragments are sent right from the buffer of the caller by send_payload().
+ * Fragments of full size are received right into the buffer of the caller:
+ * message is placed so its payload is the next fragment of buffer, and the
+ * bytes overwritten by its header are restored after receive. Only the first
+ * and the last fragments are copied through message on stack.
+ *
+ * Sender must not send other messages to the same peer until stream is
+ * complete, because fragments are told apart from other messages only by
+ * their order.
+ */
+
+enum {
+    STREAM_OPEN_LEN = 8 ///< Length of payload of opening message
+};
+
+/**
+ * Stream of fragments between current process and peer.
+ */
+typedef struct {
+    local_id peer;   ///< Identifier of destination or source process
+    int16_t  type;   ///< Type of all messages of stream
+    size_t   size;   ///< Total size of data in bytes
+    size_t   offset; ///< Count of bytes already sent or received
+} Stream;
+
+/**
+ * Starts stream to peer by sending opening message.
+ *
+ * @param state a state of current process
+ * @param stream stream structure allocated by the caller
+ * @param to destination process identifier
+ * @param type type of all messages of stream
+ * @param size total size of data in bytes
+ * @return 0 if success
+ */
+int open_stream(ProcessState *state, Stream *stream, local_id to, int16_t type, size_t size);
+
+/**
+ * Sends the next fragment of stream. Data of fragment must be ready in
+ * buffer at stream->offset, so producer can fill buffer while sending it.
+ *
+ * @param state a state of current process
+ * @param stream stream started by open_stream()
+ * @param data buffer with all data of stream
+ * @return 0 if success
+ */
+int send_fragment(ProcessState *state, Stream *stream, const char *data);
+
+/**
+ * Accepts stream from peer by receiving opening message, so the caller can
+ * allocate buffer of stream->size bytes before fragments are received.
+ *
+ * @param state a state of current process
+ * @param stream stream structure allocated by the caller
+ * @param from source process identifier
+ * @param type expected type of all messages of stream
+ * @return 0 if success
+ */
+int accept_stream(ProcessState *state, Stream *stream, local_id from, int16_t type);
+
+/**
+ * Receives the next fragment of stream to buffer at stream->offset. Bytes
+ * before new offset are ready to be consumed.
+ *
+ * @param state a state of current process
+ * @param stream stream started by accept_stream()
+ * @param data buffer of at least stream->size bytes
+ * @return 0 if success
+ */
+int receive_fragment(ProcessState *state, Stream *stream, char *data);
+
+/**
+ * Sends whole buffer to peer as stream.
+ *
+ * @param state a state of current process
+ * @param to destination process identifier
+ * @param type type of all messages of stream
+ * @param data data to send
+ * @param size size of data in bytes
+ * @return 0 if success
+ */
+int send_stream(ProcessState *state, local_id to, int16_t type, const char *data, size_t size);
+
+/**
+ * Receives whole stream from peer to buffer.
+ *
+ * @param state a state of current process
+ * @param from source process identifier
+ * @param type expected type of all messages of stream
+ * @param data buffer for received data
+ * @param capacity size of buffer in bytes, larger stream fails
+ * @param size size of received data in bytes
+ * @return 0 if success
+ */
+int receive_stream(ProcessState *state, local_id from, int16_t type, char *data, size_t capacity, size_t *size);
+
+#endif //PA1_STREAM_H
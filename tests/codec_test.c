@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include "../codec.h"
+
+/*
+ * Round-trip, malformed input and fuzz tests of codec. Every failed check is printed to
+ * stderr, exit code is the count of failed tests.
+ */
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: ", __func__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            return 1; \
+        } \
+    } while (0)
+
+enum {
+    FUZZ_ROUNDS = 100000, ///< Count of random inputs of every fuzz test
+    FRAMES_COUNT = 64,    ///< Count of frames in buffer of decode_headers() tests
+    PAYLOAD_GUARD = 64    ///< Count of bytes after payload buffer that decompression must not touch
+};
+
+static const int16_t header_types[] = {STARTED, DONE, ACK, STOP, TRANSFER, BALANCE_HISTORY, CS_REQUEST, CS_REPLY,
+                                       CS_RELEASE, -1, INT16_MIN, INT16_MAX};
+static const timestamp_t header_times[] = {0, 1, -1, 255, 256, INT16_MIN, INT16_MAX};
+
+/**
+ * Returns the next pseudo-random number, so runs are reproducible.
+ *
+ * @return random number
+ */
+uint32_t next_random(void);
+
+/**
+ * Encodes header of given fields.
+ *
+ * @param buffer a buffer for encoded header of sizeof(MessageHeader) bytes
+ * @param magic magic signature
+ * @param type type of message
+ * @param payload_len length of payload
+ * @param local_time Lamport time
+ */
+void encode_fields(unsigned char *buffer, uint16_t magic, int16_t type, uint16_t payload_len, timestamp_t local_time);
+
+/**
+ * Appends varint to buffer the same way as compressor does.
+ *
+ * @param buffer buffer for varint
+ * @param offset offset of varint in buffer, advanced past it
+ * @param value value to append
+ */
+void append_varint(unsigned char *buffer, size_t *offset, uint32_t value);
+
+/**
+ * Fills payload with one of test patterns.
+ *
+ * @param payload buffer for payload
+ * @param size length of payload
+ * @param pattern 0 for zeros, 1 for balance history, 2 for ramp of 16-bit words, 3 for random bytes
+ */
+void fill_pattern(char *payload, size_t size, int pattern);
+
+/**
+ * Decompresses packed payload to buffer followed by guard bytes and checks
+ * that guard is intact and restored length is valid.
+ *
+ * @param packed compressed payload
+ * @param size length of compressed payload
+ * @param payload buffer of MAX_PAYLOAD_LEN + PAYLOAD_GUARD bytes for restored payload
+ * @param payload_len length of restored payload
+ * @return result of decompress_payload(), -1 if guard or length is broken
+ */
+int guarded_decompress(const unsigned char *packed, size_t size, char *payload, uint16_t *payload_len);
+
+/**
+ * Checks that all types, lengths and times survive encode_header() and
+ * decode_header() and that encoded_type() agrees with them.
+ */
+int test_header_round_trip(void);
+
+/**
+ * Checks that headers with bad magic or too long payload are rejected.
+ */
+int test_header_rejects(void);
+
+/**
+ * Checks that decode_headers() decodes consecutive frames, stops at
+ * truncated frame and reports offset of corrupted header.
+ */
+int test_headers_frames(void);
+
+/**
+ * Checks that random headers are accepted only if they are valid and that
+ * decode_headers() never consumes bytes beyond buffer.
+ */
+int test_headers_fuzz(void);
+
+/**
+ * Checks that payloads of all patterns and lengths survive compression and
+ * that short or incompressible payloads are sent as is.
+ */
+int test_compress_round_trip(void);
+
+/**
+ * Checks that every truncated compressed payload is rejected.
+ */
+int test_decompress_truncated(void);
+
+/**
+ * Checks that overlong varints, tokens out of range, runs and lengths
+ * beyond payload bound and trailing bytes are rejected.
+ */
+int test_decompress_malformed(void);
+
+/**
+ * Checks that random and mutated compressed payloads never write beyond
+ * payload bound.
+ */
+int test_decompress_fuzz(void);
+
+int main(void) {
+    int (*const tests[])(void) = {test_header_round_trip, test_header_rejects, test_headers_frames, test_headers_fuzz,
+                                  test_compress_round_trip, test_decompress_truncated, test_decompress_malformed,
+                                  test_decompress_fuzz};
+    int failed, i;
+
+    failed = 0;
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); ++i) {
+        failed += tests[i]();
+    }
+    printf("codec tests: %d of %d failed\n", failed, (int) (sizeof(tests) / sizeof(tests[0])));
+
+    return failed;
+}
+
+int test_header_round_trip(void) {
+    unsigned char buffer[sizeof(MessageHeader)];
+    MessageHeader header, decoded;
+    size_t type, time;
+    int length;
+
+    for (type = 0; type < sizeof(header_types) / sizeof(header_types[0]); ++type) {
+        for (length = 0; length <= MAX_PAYLOAD_LEN; ++length) {
+            for (time = 0; time < sizeof(header_times) / sizeof(header_times[0]); ++time) {
+                header.s_magic = MESSAGE_MAGIC;
+                header.s_type = header_types[type];
+                header.s_payload_len = (uint16_t) length;
+                header.s_local_time = 0;
+                encode_header(buffer, &header, header_times[time]);
+
+                CHECK(!decode_header(buffer, &decoded), "valid header rejected: type=%d length=%d",
+                      header.s_type, length);
+                CHECK(decoded.s_magic == MESSAGE_MAGIC && decoded.s_type == header.s_type
+                      && decoded.s_payload_len == length && decoded.s_local_time == header_times[time],
+                      "header changed: type=%d length=%d time=%d", header.s_type, length, header_times[time]);
+                CHECK(encoded_type(buffer) == header.s_type, "encoded type differs: type=%d", header.s_type);
+                CHECK(!header_compressed(buffer), "header is compressed: length=%d", length);
+
+                mark_compressed(buffer, (size_t) length);
+                CHECK(!decode_header(buffer, &decoded) && decoded.s_payload_len == length,
+                      "compressed length changed: length=%d", length);
+                CHECK(header_compressed(buffer) && encoded_type(buffer) == header.s_type,
+                      "compressed header is broken: type=%d length=%d", header.s_type, length);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int test_header_rejects(void) {
+    unsigned char buffer[sizeof(MessageHeader)];
+    MessageHeader decoded;
+    long value;
+
+    for (value = 0; value <= UINT16_MAX; ++value) {
+        if (value != MESSAGE_MAGIC) {
+            encode_fields(buffer, (uint16_t) value, STARTED, 0, 0);
+            CHECK(decode_header(buffer, &decoded), "bad magic accepted: magic=%ld", value);
+        }
+    }
+    for (value = MAX_PAYLOAD_LEN + 1; value < HEADER_COMPRESSED; ++value) {
+        encode_fields(buffer, MESSAGE_MAGIC, STARTED, (uint16_t) value, 0);
+        CHECK(decode_header(buffer, &decoded), "too long payload accepted: length=%ld", value);
+        encode_fields(buffer, MESSAGE_MAGIC, STARTED, (uint16_t) (value | HEADER_COMPRESSED), 0);
+        CHECK(decode_header(buffer, &decoded), "too long compressed payload accepted: length=%ld", value);
+    }
+
+    return 0;
+}
+
+int test_headers_frames(void) {
+    unsigned char data[FRAMES_COUNT * (sizeof(MessageHeader) + 64)];
+    MessageHeader headers[FRAMES_COUNT];
+    size_t offsets[FRAMES_COUNT + 1], size, consumed, cut;
+    long count, expected;
+    int i;
+
+    size = 0;
+    for (i = 0; i < FRAMES_COUNT; ++i) {
+        offsets[i] = size;
+        encode_fields(&data[size], MESSAGE_MAGIC, (int16_t) (i % 9), (uint16_t) (i % 4 ? next_random() % 64 : 0),
+                      (timestamp_t) i);
+        size += sizeof(MessageHeader) + (data[size + 4] << 8 | data[size + 5]);
+    }
+    offsets[FRAMES_COUNT] = size;
+
+    for (cut = 0; cut <= size; ++cut) {
+        expected = 0;
+        while (expected < FRAMES_COUNT && offsets[expected + 1] <= cut) {
+            ++expected;
+        }
+        count = decode_headers(data, cut, headers, LONG_MAX, &consumed);
+        CHECK(count == expected, "wrong count of frames: cut=%zu count=%ld expected=%ld", cut, count, expected);
+        CHECK(consumed == offsets[expected], "wrong consumed bytes: cut=%zu consumed=%zu", cut, consumed);
+    }
+
+    count = decode_headers(data, size, headers, 5, &consumed);
+    CHECK(count == 5 && consumed == offsets[5], "limit is ignored: count=%ld", count);
+    CHECK(headers[4].s_local_time == 4, "wrong header decoded: time=%d", headers[4].s_local_time);
+
+    for (i = 0; i < FRAMES_COUNT; i += 7) {
+        data[offsets[i]] ^= 0x01;
+        count = decode_headers(data, size, NULL, LONG_MAX, &consumed);
+        data[offsets[i]] ^= 0x01;
+        CHECK(count == -1, "corrupted frame accepted: frame=%d", i);
+        CHECK(consumed == offsets[i], "wrong offset of corrupted frame: frame=%d consumed=%zu", i, consumed);
+    }
+
+    return 0;
+}
+
+int test_headers_fuzz(void) {
+    unsigned char data[4 * sizeof(MessageHeader) + 32];
+    MessageHeader header;
+    size_t size, consumed, i;
+    long round, count;
+
+    for (round = 0; round < FUZZ_ROUNDS; ++round) {
+        size = next_random() % sizeof(data);
+        for (i = 0; i < size; ++i) {
+            data[i] = (unsigned char) next_random();
+        }
+        if (round & 1) {
+            encode_fields(data, MESSAGE_MAGIC, (int16_t) next_random(), (uint16_t) (next_random() % 48),
+                          (timestamp_t) next_random());
+        }
+
+        if (size >= sizeof(MessageHeader) && !decode_header(data, &header)) {
+            CHECK(header.s_magic == MESSAGE_MAGIC && header.s_payload_len <= MAX_PAYLOAD_LEN,
+                  "invalid header accepted: magic=%d length=%d", header.s_magic, header.s_payload_len);
+        }
+        count = decode_headers(data, size, NULL, LONG_MAX, &consumed);
+        CHECK(consumed <= size, "consumed beyond buffer: size=%zu consumed=%zu", size, consumed);
+        CHECK(count >= -1, "wrong count of frames: count=%ld", count);
+    }
+
+    return 0;
+}
+
+int test_compress_round_trip(void) {
+    char payload[MAX_PAYLOAD_LEN], restored[MAX_PAYLOAD_LEN + PAYLOAD_GUARD];
+    unsigned char packed[MAX_PAYLOAD_LEN];
+    size_t size, packed_len;
+    uint16_t restored_len;
+    int pattern, result;
+
+    for (pattern = 0; pattern < 4; ++pattern) {
+        for (size = 0; size <= MAX_PAYLOAD_LEN; size += pattern == 3 ? 61 : 1) {
+            fill_pattern(payload, size, pattern);
+            packed_len = compress_payload(payload, size, packed);
+            if (size < COMPRESS_THRESHOLD) {
+                CHECK(!packed_len, "short payload compressed: pattern=%d size=%zu", pattern, size);
+                continue;
+            }
+            CHECK(packed_len < size, "compressed payload is not shorter: pattern=%d size=%zu", pattern, size);
+            CHECK(packed_len || pattern == 3, "payload is not compressed: pattern=%d size=%zu", pattern, size);
+            if (!packed_len) {
+                continue;
+            }
+
+            result = guarded_decompress(packed, packed_len, restored, &restored_len);
+            CHECK(!result, "compressed payload rejected: pattern=%d size=%zu result=%d", pattern, size, result);
+            CHECK(restored_len == size && !memcmp(payload, restored, size),
+                  "payload changed: pattern=%d size=%zu", pattern, size);
+        }
+    }
+
+    return 0;
+}
+
+int test_decompress_truncated(void) {
+    char payload[MAX_PAYLOAD_LEN], restored[MAX_PAYLOAD_LEN + PAYLOAD_GUARD];
+    unsigned char packed[MAX_PAYLOAD_LEN];
+    size_t sizes[] = {COMPRESS_THRESHOLD, COMPRESS_THRESHOLD + 1, 1001, MAX_PAYLOAD_LEN};
+    size_t size, packed_len, cut;
+    uint16_t restored_len;
+    int pattern;
+
+    for (pattern = 0; pattern < 3; ++pattern) {
+        for (size = 0; size < sizeof(sizes) / sizeof(sizes[0]); ++size) {
+            fill_pattern(payload, sizes[size], pattern);
+            packed_len = compress_payload(payload, sizes[size], packed);
+            CHECK(packed_len, "payload is not compressed: pattern=%d size=%zu", pattern, sizes[size]);
+            for (cut = 0; cut < packed_len; ++cut) {
+                CHECK(guarded_decompress(packed, cut, restored, &restored_len) > 0,
+                      "truncated payload accepted: pattern=%d size=%zu cut=%zu", pattern, sizes[size], cut);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int test_decompress_malformed(void) {
+    static const unsigned char overlong[][8] = {
+        {0x80, 0x80, 0x80, 0x80, 0x10},       ///< Length beyond 32 bits
+        {0x80, 0x80, 0x80, 0x80, 0x80, 0x01}, ///< Length of six groups
+        {0x81, 0x00},                         ///< Length with redundant zero group
+        {0x80, 0x80, 0x80, 0x80, 0x00}        ///< Zero length of five groups
+    };
+    static const size_t overlong_len[] = {5, 6, 2, 5};
+    char restored[MAX_PAYLOAD_LEN + PAYLOAD_GUARD];
+    unsigned char packed[64];
+    uint16_t restored_len;
+    size_t size, i;
+
+    for (i = 0; i < sizeof(overlong_len) / sizeof(overlong_len[0]); ++i) {
+        CHECK(guarded_decompress(overlong[i], overlong_len[i], restored, &restored_len) > 0,
+              "overlong length accepted: case=%zu", i);
+    }
+
+    size = 0;
+    append_varint(packed, &size, MAX_PAYLOAD_LEN + 1);
+    append_varint(packed, &size, (MAX_PAYLOAD_LEN + 1) / 2 << 1 | 1);
+    packed[size++] = 0;
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "length beyond payload bound accepted");
+
+    size = 0;
+    append_varint(packed, &size, UINT32_MAX);
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "maximal length accepted");
+
+    size = 0;
+    append_varint(packed, &size, 8);
+    append_varint(packed, &size, 5 << 1 | 1);
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "run beyond payload accepted");
+
+    size = 0;
+    append_varint(packed, &size, 8);
+    append_varint(packed, &size, 0 << 1 | 1);
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "empty run accepted");
+
+    size = 0;
+    append_varint(packed, &size, 2);
+    append_varint(packed, &size, (UINT16_MAX + 1u) << 1);
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "delta beyond 16 bits accepted");
+
+    size = 0;
+    append_varint(packed, &size, 2);
+    packed[size++] = 0x82;
+    packed[size++] = 0x00;
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "overlong token accepted");
+
+    size = 0;
+    append_varint(packed, &size, 4);
+    append_varint(packed, &size, 2 << 1 | 1);
+    packed[size++] = 0;
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "trailing byte accepted");
+
+    size = 0;
+    append_varint(packed, &size, 5);
+    append_varint(packed, &size, 2 << 1 | 1);
+    CHECK(guarded_decompress(packed, size, restored, &restored_len) > 0, "missing odd byte accepted");
+    packed[size++] = 7;
+    CHECK(!guarded_decompress(packed, size, restored, &restored_len) && restored_len == 5 && restored[4] == 7,
+          "valid payload rejected");
+
+    return 0;
+}
+
+int test_decompress_fuzz(void) {
+    char payload[MAX_PAYLOAD_LEN], restored[MAX_PAYLOAD_LEN + PAYLOAD_GUARD];
+    unsigned char packed[MAX_PAYLOAD_LEN];
+    size_t size, packed_len, i;
+    uint16_t restored_len;
+    long round;
+
+    for (round = 0; round < FUZZ_ROUNDS / 10; ++round) {
+        if (round & 1) {
+            size = COMPRESS_THRESHOLD + next_random() % (MAX_PAYLOAD_LEN - COMPRESS_THRESHOLD + 1);
+            fill_pattern(payload, size, 1);
+            packed_len = compress_payload(payload, size, packed);
+            CHECK(packed_len, "payload is not compressed: size=%zu", size);
+            for (i = next_random() % 4; i < 4; ++i) {
+                packed[next_random() % packed_len] ^= (unsigned char) (1u << next_random() % 8);
+            }
+        } else {
+            packed_len = next_random() % 256;
+            for (i = 0; i < packed_len; ++i) {
+                packed[i] = (unsigned char) next_random();
+            }
+        }
+        CHECK(guarded_decompress(packed, packed_len, restored, &restored_len) >= 0,
+              "payload bound is broken: round=%ld", round);
+    }
+
+    return 0;
+}
+
+uint32_t next_random(void) {
+    static uint32_t seed = 2463534242u;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+void encode_fields(unsigned char *buffer, uint16_t magic, int16_t type, uint16_t payload_len, timestamp_t local_time) {
+    buffer[0] = (unsigned char) (magic >> 8);
+    buffer[1] = (unsigned char) magic;
+    buffer[2] = (unsigned char) ((uint16_t) type >> 8);
+    buffer[3] = (unsigned char) type;
+    buffer[4] = (unsigned char) (payload_len >> 8);
+    buffer[5] = (unsigned char) payload_len;
+    buffer[6] = (unsigned char) ((uint16_t) local_time >> 8);
+    buffer[7] = (unsigned char) local_time;
+}
+
+void append_varint(unsigned char *buffer, size_t *offset, uint32_t value) {
+    do {
+        buffer[(*offset)++] = (unsigned char) ((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+}
+
+void fill_pattern(char *payload, size_t size, int pattern) {
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        switch (pattern) {
+            case 0:
+                payload[i] = 0;
+                break;
+            case 1:
+                payload[i] = (char) (i & 1 ? 0 : (i / 2 < 600 ? 10 + i / 64 : 30));
+                break;
+            case 2:
+                payload[i] = (char) (i & 1 ? i / 512 : i / 2);
+                break;
+            default:
+                payload[i] = (char) next_random();
+        }
+    }
+}
+
+int guarded_decompress(const unsigned char *packed, size_t size, char *payload, uint16_t *payload_len) {
+    int result, i;
+
+    memset(&payload[MAX_PAYLOAD_LEN], 0x5A, PAYLOAD_GUARD);
+    *payload_len = 0;
+    result = decompress_payload(packed, size, payload, payload_len);
+    for (i = 0; i < PAYLOAD_GUARD; ++i) {
+        if (payload[MAX_PAYLOAD_LEN + i] != 0x5A) {
+            fprintf(stderr, "%s: payload bound is broken: size=%zu\n", __func__, size);
+            return -1;
+        }
+    }
+    if (!result && *payload_len > MAX_PAYLOAD_LEN) {
+        fprintf(stderr, "%s: restored length is too long: length=%d\n", __func__, *payload_len);
+        return -1;
+    }
+
+    return result;
+}
@@ -0,0 +1,19 @@
+cd "$(dirname "$0")"
+rm -f codec_test lab
+
+${CC:-cc} -std=c99 -Wall -pedantic -O2 codec_test.c ../codec.c -o codec_test || exit 1
+./codec_test || exit 1
+
+# bank of 60 accounts moves Lamport time far beyond steps fitting into single message
+${CC:-cc} -std=c99 -Wall -pedantic -pthread -O2 ../*.c -o lab || exit 1
+lab="$PWD/lab"
+work=$(mktemp -d)
+for options in "-t shm" "-t shm -z" "-t sockets -b 4096" "-m thread"; do
+    if ! (cd "$work" && "$lab" -p 60 $(seq 1 60) $options > /dev/null); then
+        echo "bank failed: options=$options"
+        rm -rf "$work"
+        exit 1
+    fi
+done
+rm -rf "$work"
+echo "bank runs passed"
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "trace.h"
+#include "distributed.h"
+
+/**
+ * Writes events of single process to trace file.
+ *
+ * @param state a state of parent process
+ * @param file trace file
+ * @param id identifier of process
+ * @param origin time of the earliest event in nanoseconds
+ * @param flows non-zero to connect messages with flow events
+ */
+void write_trace_events(ProcessState *state, FILE *file, local_id id, long long origin, int flows);
+
+int init_trace(ProcessState *state) {
+    struct Trace *region;
+    size_t size;
+
+    size = sizeof(struct Trace) + (size_t) (state->processes_count + 1) * sizeof(TraceRing);
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Failed to map trace rings: size=%zu error=%s\n", size, strerror(errno));
+        return 1;
+    }
+    region->size = size;
+    region->processes_count = state->processes_count;
+    state->trace = region;
+
+    return 0;
+}
+
+int export_trace(ProcessState *state) {
+    struct Trace *region;
+    FILE *file;
+    long long origin;
+    int id, flows;
+
+    region = state->trace;
+    if (!region) {
+        return 0;
+    }
+
+    origin = -1;
+    flows = 1;
+    for (id = 0; id <= region->processes_count; ++id) {
+        TraceRing *ring;
+        long long oldest;
+
+        ring = &region->rings[id];
+        if (!ring->count) {
+            continue;
+        }
+        oldest = ring->count > TRACE_CAPACITY ? ring->count - TRACE_CAPACITY : 0;
+        if (origin < 0 || ring->events[oldest & (TRACE_CAPACITY - 1)].time < origin) {
+            origin = ring->events[oldest & (TRACE_CAPACITY - 1)].time;
+        }
+        flows &= ring->count <= TRACE_CAPACITY;
+    }
+
+    file = fopen(trace_log, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open trace: error=%s\n", strerror(errno));
+        munmap(region, region->size);
+        state->trace = NULL;
+        return 1;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (id = 0; id <= region->processes_count; ++id) {
+        write_trace_events(state, file, (local_id) id, origin, flows);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(file);
+
+    munmap(region, region->size);
+    state->trace = NULL;
+    return 0;
+}
+
+void write_trace_events(ProcessState *state, FILE *file, local_id id, long long origin, int flows) {
+    TraceRing *ring;
+    long long sent[state->processes_count + 1], received[state->processes_count + 1];
+    long long i;
+    long total;
+
+    total = state->processes_count + 1;
+    memset(sent, 0, sizeof(sent));
+    memset(received, 0, sizeof(received));
+
+    ring = &state->trace->rings[id];
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            id == PARENT_ID ? "" : ",\n", id, id == PARENT_ID ? "parent" : "child", id);
+
+    for (i = ring->count > TRACE_CAPACITY ? ring->count - TRACE_CAPACITY : 0; i < ring->count; ++i) {
+        TraceEvent *event;
+        double time;
+
+        event = &ring->events[i & (TRACE_CAPACITY - 1)];
+        time = (event->time - origin) / 1000.0;
+        switch (event->kind) {
+            case TRACE_PHASE_BEGIN:
+            case TRACE_PHASE_END:
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}",
+                        event->name, event->kind == TRACE_PHASE_BEGIN ? "B" : "E", time, id);
+                break;
+            case TRACE_SEND:
+                fprintf(file, ",\n{\"name\":\"send %s\",\"cat\":\"message\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":0,\"tid\":%d,\"args\":{\"to\":%d}}",
+                        message_type_name(event->type), time, id, event->peer);
+                if (flows) {
+                    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"s\",\"id\":%lld,\"ts\":%.3f,"
+                            "\"pid\":0,\"tid\":%d}", message_type_name(event->type),
+                            ((long long) id * total + event->peer) << 32 | sent[(int) event->peer]++, time, id);
+                }
+                break;
+            default:
+                fprintf(file, ",\n{\"name\":\"receive %s\",\"cat\":\"message\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":0,\"tid\":%d,\"args\":{\"from\":%d}}",
+                        message_type_name(event->type), time, id, event->peer);
+                if (flows) {
+                    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%lld,"
+                            "\"ts\":%.3f,\"pid\":0,\"tid\":%d}", message_type_name(event->type),
+                            ((long long) event->peer * total + id) << 32 | received[(int) event->peer]++, time, id);
+                }
+        }
+    }
+}
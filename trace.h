@@ -0,0 +1,101 @@
+#include "core.h"
+#include "clock.h"
+
+#ifndef PA1_TRACE_H
+#define PA1_TRACE_H
+
+/*
+ * Every process records events to preallocated ring of its own. Rings are
+ * shared with parent, which exports them after join.
+ */
+
+static const char * const trace_log = "trace.json";
+
+enum {
+    TRACE_CAPACITY = 1 << 16 ///< Count of events in ring of single process, must be power of two
+};
+
+/**
+ * Kind of trace event.
+ */
+typedef enum {
+    TRACE_SEND = 0,    ///< Message was sent to peer
+    TRACE_RECEIVE,     ///< Message was received from peer
+    TRACE_PHASE_BEGIN, ///< Phase has started
+    TRACE_PHASE_END    ///< Phase has finished
+} TraceKind;
+
+/**
+ * Single trace event.
+ */
+typedef struct {
+    long long   time; ///< Monotonic time in nanoseconds
+    const char *name; ///< Name of phase (only for phase events)
+    int16_t     type; ///< Type of message (only for message events)
+    local_id    peer; ///< Peer process identifier (only for message events)
+    char        kind; ///< Kind of event, TraceKind
+} TraceEvent;
+
+/**
+ * Ring of trace events of single process. The oldest events are overwritten
+ * when ring is full.
+ */
+typedef struct {
+    long long  count;                  ///< Total count of recorded events
+    TraceEvent events[TRACE_CAPACITY]; ///< Recorded events
+} TraceRing;
+
+/**
+ * Trace shared by all processes with ring of every process.
+ */
+struct Trace {
+    size_t    size;            ///< Size of mapped region in bytes
+    long      processes_count; ///< Total count of processes excluding parent
+    TraceRing rings[];         ///< Rings by process identifier
+};
+
+/**
+ * Maps rings of all processes. Must be called by parent before fork.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int init_trace(ProcessState *state);
+
+/**
+ * Merges rings of all processes into Chrome trace JSON file trace.json and
+ * unmaps rings. Messages are connected with flow events by their order in
+ * channel. Must be called by parent after all children are joined. Does
+ * nothing if tracing is disabled.
+ *
+ * @param state a state of parent process
+ * @return 0 if success
+ */
+int export_trace(ProcessState *state);
+
+/**
+ * Records trace event of current process.
+ *
+ * @param state a state of current process
+ * @param kind kind of event
+ * @param peer peer process identifier (only for message events)
+ * @param type type of message (only for message events)
+ * @param name name of phase (only for phase events)
+ */
+static inline void trace_event(ProcessState *state, TraceKind kind, local_id peer, int type, const char *name) {
+    if (state->trace) {
+        TraceRing *ring;
+        TraceEvent *event;
+
+        ring = &state->trace->rings[state->id];
+        event = &ring->events[ring->count & (TRACE_CAPACITY - 1)];
+        event->time = monotonic_ns();
+        event->name = name;
+        event->type = (int16_t) type;
+        event->peer = peer;
+        event->kind = (char) kind;
+        ++ring->count;
+    }
+}
+
+#endif //PA1_TRACE_H